@@ -5,19 +5,25 @@
 
 class CircularWireConstraint {
  public:
-  CircularWireConstraint(Particle *i_p, const Vec2f & i_center, const double i_radius);
+  CircularWireConstraint(const Particle & i_p, const Vec2f & i_center, const double i_radius);
 
-  void draw();
   double get_C();
   double get_Cdot();
   Vec2f get_J();
   Vec2f get_Jdot();
   double get_mass();
   int get_id();
+  Vec2f get_center();
+  double get_radius();
+  // the Lagrange multiplier of the last solve, used as the next initial guess
+  double get_lambda();
+  void set_lambda(double i_lambda);
 
  private:
 
-  Particle * const p;
+  ParticleStore * const store;
+  int const id;
   Vec2f const center;
   double const radius;
+  double lambda;
 };
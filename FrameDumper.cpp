@@ -0,0 +1,166 @@
+#define GL_GLEXT_PROTOTYPES
+#include "FrameDumper.h"
+#include <stdio.h>
+#include <string.h>
+#include <GLUT/glut.h>
+
+// pixel buffers in flight, one being filled while the other is collected
+#define NUM_SLOTS 2
+
+FrameDumper::FrameDumper(int numWorkers, int i_numBuffers, FrameStream * i_stream) :
+        stream(i_stream), nextSlot(0), numBuffers(i_numBuffers), allocated(0), quit(false)
+{
+        slots.resize(NUM_SLOTS);
+        for(int s = 0; s < NUM_SLOTS; ++s){
+                GLuint pbo;
+                glGenBuffers(1, &pbo);
+                slots[s].pbo = pbo;
+                slots[s].state = SLOT_FREE;
+        }
+        // a stream takes its frames in order, so only one worker may write to it
+        if(stream)
+                numWorkers = 1;
+        for(int t = 0; t < numWorkers; ++t){
+                threads.push_back(std::thread(&FrameDumper::worker, this));
+        }
+}
+
+FrameDumper::~FrameDumper(void)
+{
+        finish();
+        {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+        }
+        ready.notify_all();
+        for(int t = 0; t < threads.size(); ++t){
+                threads[t].join();
+        }
+        for(int s = 0; s < slots.size(); ++s){
+                GLuint pbo = slots[s].pbo;
+                glDeleteBuffers(1, &pbo);
+        }
+}
+
+void FrameDumper::capture(const char * filename, int width, int height)
+{
+        Slot & slot = slots[nextSlot];
+        nextSlot = (nextSlot + 1) % slots.size();
+        if(slot.state != SLOT_FREE)
+                queue(slot);
+
+        // the read returns at once and the pixels arrive in the buffer later
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        slot.state = SLOT_THIS_FRAME;
+        slot.filename = filename;
+        slot.width = width;
+        slot.height = height;
+}
+
+void FrameDumper::collect()
+{
+        for(int s = 0; s < slots.size(); ++s){
+                if(slots[s].state == SLOT_EARLIER)
+                        queue(slots[s]);
+                else if(slots[s].state == SLOT_THIS_FRAME)
+                        slots[s].state = SLOT_EARLIER;
+        }
+}
+
+void FrameDumper::finish()
+{
+        // oldest first, so the frames are queued in the order they were captured
+        for(int i = 0; i < slots.size(); ++i){
+                Slot & slot = slots[(nextSlot + i) % slots.size()];
+                if(slot.state != SLOT_FREE)
+                        queue(slot);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(pool.size() < allocated)
+                freed.wait(lock);
+}
+
+void FrameDumper::set_png_options(const PngOptions & options)
+{
+        std::lock_guard<std::mutex> lock(mutex);
+        pngOptions = options;
+}
+
+void FrameDumper::queue(Slot & slot)
+{
+        Job job;
+        job.filename = slot.filename;
+        job.width = slot.width;
+        job.height = slot.height;
+        {
+                // take a buffer from the pool, or make one while the pool is
+                // smaller than numBuffers
+                std::unique_lock<std::mutex> lock(mutex);
+                while(pool.empty() && allocated >= numBuffers)
+                        freed.wait(lock);
+                if(pool.empty()){
+                        ++allocated;
+                } else{
+                        job.pixels.swap(pool.back());
+                        pool.pop_back();
+                }
+        }
+        job.pixels.resize(slot.width * slot.height * 4);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const void * pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if(pixels){
+                memcpy(&job.pixels[0], pixels, job.pixels.size());
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        } else{
+                printf("could not read back %s\n", job.filename.c_str());
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.state = SLOT_FREE;
+
+        {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+        }
+        ready.notify_one();
+}
+
+void FrameDumper::worker()
+{
+        for(;;){
+                Job job;
+                {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        while(!quit && jobs.empty())
+                                ready.wait(lock);
+                        if(jobs.empty())
+                                return;
+                        job = std::move(jobs.front());
+                        jobs.pop_front();
+                }
+
+                if(stream){
+                        stream->write(&job.pixels[0], job.width, job.height);
+                } else{
+                        std::vector<char> filename(job.filename.begin(), job.filename.end());
+                        filename.push_back('\0');
+                        if(saveImageRGBA(&filename[0], &job.pixels[0], job.width, job.height, pngOptions))
+                                printf("Dumped %s.\n", job.filename.c_str());
+                        else
+                                printf("could not write %s\n", job.filename.c_str());
+                }
+
+                {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        pool.push_back(std::vector<unsigned char>());
+                        pool.back().swap(job.pixels);
+                }
+                freed.notify_all();
+        }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "FrameStream.h"
+#include "imageio.h"
+
+// Writes frames of the window to png files without holding up the GL
+// thread. capture() starts reading the framebuffer back into a pixel
+// buffer object, which the driver fills while the next frame is drawn.
+// A frame later the pixels are copied into one of a pool of buffers and
+// queued to worker threads that encode the pngs in parallel. When every
+// buffer of the pool is queued or being written, capture waits for one.
+// Given a FrameStream, the frames are instead appended to it in order by
+// a single worker. Needs OpenGL 2.1 pixel buffer objects, so create it
+// once the window's context is current.
+class FrameDumper
+{
+public:
+    // numWorkers threads encode the pngs, and at most numBuffers frames
+    // wait for them or are being written at once. The stream, if any,
+    // must outlive the dumper.
+    FrameDumper(int numWorkers = 2, int numBuffers = 8, FrameStream * i_stream = NULL);
+    // writes every frame captured so far, then stops the workers
+    ~FrameDumper(void);
+
+    // starts reading the width by height framebuffer back to write to
+    // filename, which is ignored when writing to a stream
+    void capture(const char * filename, int width, int height);
+    // queues the frames captured before this frame to be written. Call it
+    // once every frame, after any capture.
+    void collect();
+    // queues every captured frame and waits until they are all written
+    void finish();
+    // the settings the pngs are encoded with, set before the first capture
+    void set_png_options(const PngOptions & options);
+
+private:
+    FrameDumper(const FrameDumper &);
+    FrameDumper & operator=(const FrameDumper &);
+
+    enum SlotState { SLOT_FREE, SLOT_THIS_FRAME, SLOT_EARLIER };
+
+    // a frame read back into a pixel buffer object
+    struct Slot
+    {
+        unsigned int pbo;
+        SlotState state;
+        std::string filename;
+        int width, height;
+    };
+
+    // a frame waiting for a worker, its pixels taken from the pool
+    struct Job
+    {
+        std::vector<unsigned char> pixels;
+        std::string filename;
+        int width, height;
+    };
+
+    // maps the slot's pixel buffer and queues its frame
+    void queue(Slot & slot);
+    void worker();
+
+    FrameStream * stream;
+    PngOptions pngOptions;
+    std::vector<Slot> slots;
+    int nextSlot;
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable ready;   // a job was queued, or quit was set
+    std::condition_variable freed;   // a buffer went back to the pool
+    std::deque<Job> jobs;
+    std::vector< std::vector<unsigned char> > pool;
+    int numBuffers;
+    int allocated;
+    bool quit;
+};
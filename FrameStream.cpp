@@ -0,0 +1,95 @@
+#include "FrameStream.h"
+#include <string.h>
+
+// bytes of stdio buffer in front of the file or pipe
+#define STREAM_BUFFER (4 << 20)
+// the frame rate written when none is given, the viewer's default
+#define STREAM_DEFAULT_FPS 60
+
+FrameStream::FrameStream(const char * target, int i_fps) :
+        fp(NULL), piped(false), format(STREAM_RGBA), fps(i_fps > 0 ? i_fps : STREAM_DEFAULT_FPS),
+        width(0), height(0)
+{
+        if(target[0] == '|'){
+                // encoders such as ffmpeg -i - read the size and rate from the Y4M header
+                piped = true;
+                format = STREAM_Y4M;
+                fp = popen(target + 1, "w");
+        } else{
+                int len = strlen(target);
+                if(len >= 4 && !strcmp(target + len - 4, ".y4m"))
+                        format = STREAM_Y4M;
+                fp = fopen(target, "wb");
+        }
+        if(!fp){
+                printf("could not open %s\n", target);
+                return;
+        }
+        setvbuf(fp, NULL, _IOFBF, STREAM_BUFFER);
+}
+
+FrameStream::~FrameStream(void)
+{
+        if(!fp)
+                return;
+        if(piped)
+                pclose(fp);
+        else
+                fclose(fp);
+}
+
+bool FrameStream::is_open() const
+{
+        return fp != NULL;
+}
+
+bool FrameStream::write(const unsigned char * pixels, int i_width, int i_height)
+{
+        if(!fp)
+                return false;
+        if(width == 0){
+                width = i_width;
+                height = i_height;
+                if(format == STREAM_Y4M)
+                        fprintf(fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+        }
+        if(i_width != width || i_height != height){
+                printf("skipped a %dx%d frame of a %dx%d stream\n", i_width, i_height, width, height);
+                return false;
+        }
+
+        // the rows are turned top first on the way out
+        size_t rowBytes = 4 * width;
+        if(format == STREAM_RGBA){
+                for(int y = height - 1; y >= 0; --y){
+                        if(fwrite(pixels + y * rowBytes, 1, rowBytes, fp) != rowBytes){
+                                printf("could not write a frame to the stream\n");
+                                return false;
+                        }
+                }
+                return true;
+        }
+
+        // BT.601 studio range, in 8 bit fixed point
+        size_t plane = (size_t)width * height;
+        yuv.resize(3 * plane);
+        unsigned char * Y = &yuv[0];
+        unsigned char * U = Y + plane;
+        unsigned char * V = U + plane;
+        for(int y = 0; y < height; ++y){
+                const unsigned char * row = pixels + (height - 1 - y) * rowBytes;
+                for(int x = 0; x < width; ++x){
+                        int r = row[4*x], g = row[4*x+1], b = row[4*x+2];
+                        int i = y * width + x;
+                        Y[i] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+                        U[i] = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+                        V[i] = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+                }
+        }
+        fputs("FRAME\n", fp);
+        if(fwrite(&yuv[0], 1, yuv.size(), fp) != yuv.size()){
+                printf("could not write a frame to the stream\n");
+                return false;
+        }
+        return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+
+enum StreamFormat
+{
+    STREAM_RGBA,   // the bare pixels of every frame, 4 bytes each
+    STREAM_Y4M     // YUV4MPEG2 with full resolution 4:4:4 chroma
+};
+
+// Appends frames to a single file, or to the standard input of an
+// encoder process, instead of writing a png per frame. The file is
+// written through a large stdio buffer so that a frame costs a few big
+// writes and no compression.
+class FrameStream
+{
+public:
+    // target is a file name, or a shell command after a '|' to pipe the
+    // frames into. Frames are written as Y4M when piped or when the file
+    // name ends in .y4m, and as raw RGBA otherwise. fps goes in the Y4M
+    // header; 60 is written when it is not positive, as for an uncapped
+    // frame rate.
+    FrameStream(const char * target, int fps);
+    // closes the file, or waits for the encoder to finish
+    ~FrameStream(void);
+
+    bool is_open() const;
+    // appends a width by height frame of RGBA pixels stored bottom row
+    // first, as glReadPixels returns them. The stream takes the size of
+    // its first frame, and frames of another size are skipped. Failures
+    // are printed and return false.
+    bool write(const unsigned char * pixels, int width, int height);
+
+private:
+    FrameStream(const FrameStream &);
+    FrameStream & operator=(const FrameStream &);
+
+    FILE * fp;
+    bool piped;
+    StreamFormat format;
+    int fps;
+    int width, height;
+    // one frame's Y, U and V planes
+    std::vector<unsigned char> yuv;
+};
@@ -1,25 +1,25 @@
 #pragma once
 
 #include <gfx/vec2.h>
+#include "ParticleStore.h"
 
+// A lightweight handle to one particle of a ParticleStore. The particle's
+// data lives in the store, so handles stay valid as particles are added.
 class Particle
 {
 public:
 
-        Particle(const Vec2f & ConstructPos, double mass, int i_id);
-	virtual ~Particle(void);
+        Particle(ParticleStore * i_store, int i_id);
 
 	void reset();
-	void draw();
 
-	Vec2f ConstructPos;
-	Vec2f Position;
-	Vec2f Velocity;
-	Vec2f forces;
-        // the derivitive of position and velocity respectivly
-        Vec2f deriv_position;
-        Vec2f deriv_velocity;
+	Vec2f & ConstructPos() const { return store->constructPos[id]; }
+	Vec2f & Position() const { return store->position[id]; }
+	Vec2f & Velocity() const { return store->velocity[id]; }
+	Vec2f & forces() const { return store->forces[id]; }
+        double mass() const { return 1.0 / store->invMass[id]; }
+
+        ParticleStore * store;
         // particle's numbering used in calculating lambda
         int id;
-        double mass;
 };
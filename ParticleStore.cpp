@@ -0,0 +1,52 @@
+#include "ParticleStore.h"
+
+ParticleStore::ParticleStore() :
+        version(0)
+{
+}
+
+ParticleStore::~ParticleStore(void)
+{
+}
+
+int ParticleStore::add(const Vec2f & i_ConstructPos, double mass)
+{
+        constructPos.push_back(i_ConstructPos);
+        position.push_back(Vec2f(0.0, 0.0));
+        velocity.push_back(Vec2f(0.0, 0.0));
+        forces.push_back(Vec2f(0.0, 0.0));
+        invMass.push_back(1.0 / mass);
+        touch();
+        return size() - 1;
+}
+
+void ParticleStore::pop()
+{
+        constructPos.pop_back();
+        position.pop_back();
+        velocity.pop_back();
+        forces.pop_back();
+        invMass.pop_back();
+        touch();
+}
+
+void ParticleStore::reset()
+{
+        int n = size();
+        for(int i = 0; i < n; ++i){
+                position[i] = constructPos[i];
+                velocity[i] = Vec2f(0.0, 0.0);
+                forces[i] = Vec2f(0.0, 0.0);
+        }
+        touch();
+}
+
+int ParticleStore::size() const
+{
+        return position.size();
+}
+
+void ParticleStore::touch()
+{
+        ++version;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <gfx/vec2.h>
+#include <vector>
+
+/**
+ * Contiguous structure-of-arrays storage for every particle in a system.
+ * A particle is identified by its index into these arrays, which is also
+ * the numbering used when calculating lambda.
+ */
+class ParticleStore
+{
+public:
+        ParticleStore();
+        ~ParticleStore(void);
+
+        // adds a particle at the given position and returns its index
+        int add(const Vec2f & i_ConstructPos, double mass);
+        // removes the most recently added particle
+        void pop();
+        // moves every particle back to its construction position at rest
+        void reset();
+        int size() const;
+        // records that the particles were changed by something other than
+        // an integrator's step, such as the mouse or a projection
+        void touch();
+
+        std::vector<Vec2f> constructPos;
+        std::vector<Vec2f> position;
+        std::vector<Vec2f> velocity;
+        std::vector<Vec2f> forces;
+        std::vector<double> invMass;
+        // counts the calls to touch, so that an integrator can tell whether
+        // the state its last step left behind is still there
+        unsigned long version;
+};
@@ -0,0 +1,111 @@
+#include "PositionSolver.h"
+
+PositionSolver::PositionSolver() :
+        mode(CONSTRAINT_XPBD_GAUSS_SEIDEL), iterations(10), compliance(0)
+{
+}
+
+void PositionSolver::begin(const ParticleStore & particles)
+{
+        prevPosition = particles.position;
+}
+
+void PositionSolver::solve(ParticleStore & particles, int k, int i, int j, const Vec2 & n,
+                           double C, double alphaTilde)
+{
+        double w = particles.invMass[i];
+        if(j >= 0)
+                w += particles.invMass[j];
+        if(w + alphaTilde == 0)
+                return;
+
+        double dLambda = (-C - alphaTilde * lambda[k]) / (w + alphaTilde);
+
+        Vec2 di = n * (dLambda * particles.invMass[i]);
+        Vec2 dj = n * (-dLambda * (j >= 0 ? particles.invMass[j] : 0.0));
+        if(mode == CONSTRAINT_XPBD_JACOBI){
+                // the corrections are averaged over the constraints sharing a
+                // particle, so the multiplier only takes the averaged share
+                // of its change, that of the more shared of its particles
+                int shared = count[i];
+                if(j >= 0 && count[j] > shared)
+                        shared = count[j];
+                lambda[k] += dLambda / shared;
+                delta[i] += di;
+                if(j >= 0)
+                        delta[j] += dj;
+        } else{
+                lambda[k] += dLambda;
+                particles.position[i] += Vec2f(di);
+                if(j >= 0)
+                        particles.position[j] += Vec2f(dj);
+        }
+}
+
+void PositionSolver::project(ParticleStore & particles,
+                             const std::vector<CircularWireConstraint*> & wireConstVector,
+                             const std::vector<RodConstraint*> & rodConstVector, float dt)
+{
+        int size = particles.size();
+        int num_wC = wireConstVector.size();
+        int num_rC = rodConstVector.size();
+        double alphaTilde = compliance / ((double)dt * dt);
+
+        lambda.assign(num_wC + num_rC, 0.0);
+        delta.resize(size);
+
+        // the constraints on each particle, which its corrections are averaged over
+        if(mode == CONSTRAINT_XPBD_JACOBI){
+                count.assign(size, 0);
+                for(int k = 0; k < num_wC; ++k){
+                        count[wireConstVector[k]->get_id()]++;
+                }
+                for(int k = 0; k < num_rC; ++k){
+                        count[rodConstVector[k]->get_id1()]++;
+                        count[rodConstVector[k]->get_id2()]++;
+                }
+        }
+
+        for(int it = 0; it < iterations; ++it){
+                if(mode == CONSTRAINT_XPBD_JACOBI){
+                        for(int i = 0; i < size; ++i){
+                                delta[i] = Vec2(0.0, 0.0);
+                        }
+                }
+
+                // C = |x - center| - radius
+                for(int k = 0; k < num_wC; ++k){
+                        CircularWireConstraint * wire = wireConstVector[k];
+                        int i = wire->get_id();
+                        Vec2 X = Vec2(particles.position[i]) - Vec2(wire->get_center());
+                        double len = norm(X);
+                        // so that if the particle is on the center the program does not blow up
+                        if(len == 0)
+                                continue;
+                        solve(particles, k, i, -1, X / len, len - wire->get_radius(), alphaTilde);
+                }
+
+                // C = |x1 - x2| - dist
+                for(int k = 0; k < num_rC; ++k){
+                        RodConstraint * rod = rodConstVector[k];
+                        int i = rod->get_id1(), j = rod->get_id2();
+                        Vec2 X = Vec2(particles.position[i]) - Vec2(particles.position[j]);
+                        double len = norm(X);
+                        if(len == 0)
+                                continue;
+                        solve(particles, num_wC + k, i, j, X / len, len - rod->get_dist(), alphaTilde);
+                }
+
+                if(mode == CONSTRAINT_XPBD_JACOBI){
+                        for(int i = 0; i < size; ++i){
+                                if(count[i] > 0)
+                                        particles.position[i] += Vec2f(delta[i] / (double)count[i]);
+                        }
+                }
+        }
+
+        // the velocity that carries the particles from where they started
+        for(int i = 0; i < size; ++i){
+                particles.velocity[i] = (particles.position[i] - prevPosition[i]) / dt;
+        }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include "ParticleStore.h"
+#include "CircularWireConstraint.h"
+#include "RodConstraint.h"
+
+// how a System enforces its rod and wire constraints
+enum ConstraintMode
+{
+    // constraint forces from a global CG solve for the Lagrange multipliers
+    CONSTRAINT_LAGRANGE,
+    // XPBD projection of one constraint at a time, each seeing the last's result
+    CONSTRAINT_XPBD_GAUSS_SEIDEL,
+    // XPBD projection of every constraint from the same positions, averaged per particle
+    CONSTRAINT_XPBD_JACOBI
+};
+
+// Extended position based dynamics (Macklin et al.) for the rod and wire
+// constraints. After the integrator has moved the particles without any
+// constraint forces, project moves them back onto the constraints with a
+// fixed number of iterations and derives the velocities from how far the
+// particles moved over the step, so its cost per step is bounded.
+class PositionSolver
+{
+public:
+    PositionSolver();
+
+    // remembers the positions at the start of a step
+    void begin(const ParticleStore & particles);
+    void project(ParticleStore & particles,
+                 const std::vector<CircularWireConstraint*> & wireConstVector,
+                 const std::vector<RodConstraint*> & rodConstVector, float dt);
+
+    // CONSTRAINT_XPBD_GAUSS_SEIDEL or CONSTRAINT_XPBD_JACOBI
+    ConstraintMode mode;
+    int iterations;
+    // inverse stiffness of the constraints, 0 makes them rigid
+    double compliance;
+
+private:
+    // the correction of one constraint with gradient n for particle i (and
+    // -n for particle j, if j >= 0), given its value C and index k
+    void solve(ParticleStore & particles, int k, int i, int j, const Vec2 & n,
+               double C, double alphaTilde);
+
+    std::vector<Vec2f> prevPosition;
+    // the multipliers accumulated over the iterations of one step
+    std::vector<double> lambda;
+    // the summed corrections per particle in Jacobi mode, and the number of
+    // constraints on it
+    std::vector<Vec2> delta;
+    std::vector<int> count;
+};
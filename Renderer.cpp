@@ -0,0 +1,126 @@
+// OpenGL drawing of the simulation. This is kept out of the simulation's
+// own files so that the simulation builds without OpenGL.
+
+#define GL_GLEXT_PROTOTYPES
+#include "Renderer.h"
+#include <math.h>
+#include <GLUT/glut.h>
+
+#define PI 3.1415926535897932384626433832795
+// vertices of the polygon a wire is drawn as
+#define WIRE_SEGMENTS 20
+
+Renderer::Renderer(void) :
+        layoutSprings(-1), layoutRods(-1), layoutWires(-1), layoutPositions(-1),
+        numSpringIndices(0), numRodIndices(0)
+{
+        GLuint buffers[3];
+        glGenBuffers(3, buffers);
+        positionBuffer = buffers[0];
+        indexBuffer = buffers[1];
+        wireBuffer = buffers[2];
+}
+
+Renderer::~Renderer(void)
+{
+        GLuint buffers[3] = { positionBuffer, indexBuffer, wireBuffer };
+        glDeleteBuffers(3, buffers);
+}
+
+void Renderer::update_layout(System & sys, int numPos)
+{
+        const SpringStore & springs = sys.get_springs();
+        const std::vector<RodConstraint*> & rods = sys.get_rodConst();
+        const std::vector<CircularWireConstraint*> & wires = sys.get_wireConst();
+
+        // the springs' index pairs followed by the rods'
+        std::vector<GLuint> indices;
+        indices.reserve(2 * (springs.size() + rods.size()));
+        for(int s = 0; s < springs.size(); ++s){
+                if(springs.id1[s] < numPos && springs.id2[s] < numPos){
+                        indices.push_back(springs.id1[s]);
+                        indices.push_back(springs.id2[s]);
+                }
+        }
+        numSpringIndices = indices.size();
+        for(int r = 0; r < rods.size(); ++r){
+                if(rods[r]->get_id1() < numPos && rods[r]->get_id2() < numPos){
+                        indices.push_back(rods[r]->get_id1());
+                        indices.push_back(rods[r]->get_id2());
+                }
+        }
+        numRodIndices = indices.size() - numSpringIndices;
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+                     indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        // the wires stay put, so their circles are worked out once here
+        std::vector<GLfloat> circles;
+        circles.reserve(2 * WIRE_SEGMENTS * wires.size());
+        wireFirst.clear();
+        wireCount.clear();
+        for(int w = 0; w < wires.size(); ++w){
+                Vec2f center = wires[w]->get_center();
+                double radius = wires[w]->get_radius();
+                wireFirst.push_back(circles.size() / 2);
+                wireCount.push_back(WIRE_SEGMENTS);
+                for(int i = 0; i < WIRE_SEGMENTS; ++i){
+                        double angle = 2 * PI * i / WIRE_SEGMENTS;
+                        circles.push_back(center[0] + cos(angle) * radius);
+                        circles.push_back(center[1] + sin(angle) * radius);
+                }
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, wireBuffer);
+        glBufferData(GL_ARRAY_BUFFER, circles.size() * sizeof(GLfloat),
+                     circles.empty() ? NULL : &circles[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        layoutSprings = springs.size();
+        layoutRods = rods.size();
+        layoutWires = wires.size();
+        layoutPositions = numPos;
+}
+
+void Renderer::draw(System & sys, const std::vector<Vec2f> & position, float pointSize)
+{
+        int numPos = position.size();
+        if(sys.get_springs().size() != layoutSprings || (int)sys.get_rodConst().size() != layoutRods ||
+           (int)sys.get_wireConst().size() != layoutWires || numPos != layoutPositions)
+                update_layout(sys, numPos);
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+
+        // the frame's positions are uploaded once and shared by everything below
+        glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        glBufferData(GL_ARRAY_BUFFER, numPos * sizeof(Vec2f),
+                     numPos ? &position[0] : NULL, GL_STREAM_DRAW);
+        glVertexPointer(2, GL_FLOAT, sizeof(Vec2f), 0);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glColor3f(0.6f, 0.7f, 0.8f);
+        glDrawElements(GL_LINES, numSpringIndices, GL_UNSIGNED_INT, 0);
+        glColor3f(0.8f, 0.7f, 0.6f);
+        glDrawElements(GL_LINES, numRodIndices, GL_UNSIGNED_INT,
+                       (const GLvoid *)(numSpringIndices * sizeof(GLuint)));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+        if(!wireFirst.empty()){
+                glBindBuffer(GL_ARRAY_BUFFER, wireBuffer);
+                glVertexPointer(2, GL_FLOAT, 0, 0);
+                glColor3f(0.0f, 1.0f, 0.0f);
+                glMultiDrawArrays(GL_LINE_LOOP, &wireFirst[0], &wireCount[0], wireFirst.size());
+                glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+                glVertexPointer(2, GL_FLOAT, sizeof(Vec2f), 0);
+        }
+
+        // square points stand in for the particles' quads
+        glColor3f(1.f, 1.f, 1.f);
+        glPointSize(pointSize);
+        glDrawArrays(GL_POINTS, 0, numPos);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glDisableClientState(GL_VERTEX_ARRAY);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include "System.h"
+
+// Draws a System with a handful of OpenGL calls per frame. The positions
+// of a frame go into one vertex buffer that the particles are drawn from
+// as points and the springs and rods as indexed lines. The index pairs
+// and the wire circles only change with the layout of the system, so
+// they are uploaded again only when it does. Needs the OpenGL 1.5 vertex
+// buffers, so create it once the window's context is current.
+class Renderer
+{
+public:
+    Renderer(void);
+    ~Renderer(void);
+
+    // draws sys with its particles at position, which may be a frame
+    // taken earlier from a SimThread. Particles are pointSize pixels wide.
+    void draw(System & sys, const std::vector<Vec2f> & position, float pointSize);
+
+private:
+    Renderer(const Renderer &);
+    Renderer & operator=(const Renderer &);
+
+    // rebuilds the index and wire buffers from the current layout
+    void update_layout(System & sys, int numPos);
+
+    // GLuint names of the buffers
+    unsigned int positionBuffer;
+    unsigned int indexBuffer;
+    unsigned int wireBuffer;
+
+    // the layout the index and wire buffers were built for. The frame may
+    // come from before particles were added, so springs and rods that
+    // refer past its end are left out until a frame includes them.
+    int layoutSprings, layoutRods, layoutWires, layoutPositions;
+    int numSpringIndices, numRodIndices;
+    std::vector<int> wireFirst, wireCount;
+};
@@ -1,35 +1,23 @@
 #include "RodConstraint.h"
-#include <GLUT/glut.h>
 
-RodConstraint::RodConstraint(Particle* i_p1, Particle* i_p2, double i_dist) :
-  p1(i_p1), p2(i_p2), dist(i_dist) {}
-
-void RodConstraint::draw()
-{
-  glBegin( GL_LINES );
-  glColor3f(0.8, 0.7, 0.6);
-  glVertex2f( p1->Position[0], p1->Position[1] );
-  glColor3f(0.8, 0.7, 0.6);
-  glVertex2f( p2->Position[0], p2->Position[1] );
-  glEnd();
-
-}
+RodConstraint::RodConstraint(const Particle & i_p1, const Particle & i_p2, double i_dist) :
+  store(i_p1.store), id1(i_p1.id), id2(i_p2.id), dist(i_dist), lambda(0) {}
 
 double RodConstraint::get_C(){
-    return norm(p1->Position - p2->Position) - dist;
+    return norm(store->position[id1] - store->position[id2]) - dist;
 }
 
 double RodConstraint::get_Cdot(){
-    Vec2f X = p1->Position - p2->Position;
+    Vec2f X = store->position[id1] - store->position[id2];
     // so that if the particles are on top of eachother the program does not die
     if(norm(X) == 0)
         return INF;
-    return (p1->Velocity - p2->Velocity) * X / norm(X);
+    return (store->velocity[id1] - store->velocity[id2]) * X / norm(X);
 }
 
 // returns dC/dx1 since dC/dx2 = -dC/dx1
 Vec2f RodConstraint::get_J(){
-    Vec2f X = p1->Position - p2->Position;
+    Vec2f X = store->position[id1] - store->position[id2];
     // so that if the particles are on top of eachother the program does not die
     if(norm(X) == 0)
         return Vec2f(INF, INF);
@@ -38,9 +26,9 @@ Vec2f RodConstraint::get_J(){
 
 // returns d(dC/dx1)/dt since d(dC/dx2)/dt = -d(dC/dx1)/dt
 Vec2f RodConstraint::get_Jdot(){
-    Vec2f X = p1->Position - p2->Position;
+    Vec2f X = store->position[id1] - store->position[id2];
     double norm_X = norm(X);
-    Vec2f V = p1->Velocity - p2->Velocity;
+    Vec2f V = store->velocity[id1] - store->velocity[id2];
     // so that if the particles are on top of eachother the program does not die
     if(norm_X == 0)
         return Vec2f(INF, INF);
@@ -48,17 +36,29 @@ Vec2f RodConstraint::get_Jdot(){
 }
 
 double RodConstraint::get_mass1(){
-    return p1->mass;
+    return 1.0 / store->invMass[id1];
 }
 
 int RodConstraint::get_id1(){
-    return p1->id;
+    return id1;
 }
 
 double RodConstraint::get_mass2(){
-    return p2->mass;
+    return 1.0 / store->invMass[id2];
 }
 
 int RodConstraint::get_id2(){
-    return p2->id;
+    return id2;
+}
+
+double RodConstraint::get_dist(){
+    return dist;
+}
+
+double RodConstraint::get_lambda(){
+    return lambda;
+}
+
+void RodConstraint::set_lambda(double i_lambda){
+    lambda = i_lambda;
 }
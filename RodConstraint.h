@@ -5,9 +5,8 @@
 
 class RodConstraint {
  public:
-  RodConstraint(Particle *i_p1, Particle* i_p2, double i_dist);
+  RodConstraint(const Particle & i_p1, const Particle & i_p2, double i_dist);
 
-  void draw();
   double get_C();
   double get_Cdot();
   Vec2f get_J();
@@ -16,10 +15,17 @@ class RodConstraint {
   int get_id1();
   double get_mass2();
   int get_id2();
+  // the rest length of the rod
+  double get_dist();
+  // the Lagrange multiplier of the last solve, used as the next initial guess
+  double get_lambda();
+  void set_lambda(double i_lambda);
 
  private:
 
-  Particle * const p1;
-  Particle * const p2;
+  ParticleStore * const store;
+  int const id1;
+  int const id2;
   double const dist;
+  double lambda;
 };
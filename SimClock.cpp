@@ -0,0 +1,65 @@
+#include "SimClock.h"
+#include <stddef.h>
+#include <sys/time.h>
+
+SimClock::SimClock(float i_dt, int i_substeps, double i_rate, double i_maxFps) :
+        dt(i_dt), substeps(i_substeps), rate(i_rate), maxFps(i_maxFps), maxSteps(1000),
+        lastStep(-1), lastRedraw(-1), owed(0), frameDue(false)
+{
+}
+
+double SimClock::now()
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+void SimClock::restart(double now)
+{
+        lastStep = now;
+        owed = 0;
+}
+
+double SimClock::until_redraw(double now)
+{
+        if(maxFps <= 0 || lastRedraw < 0)
+                return 0;
+        double wait = lastRedraw + 1.0 / maxFps - now;
+        return wait > 0 ? wait : 0;
+}
+
+bool SimClock::redraw_due(double now)
+{
+        if(frameDue || until_redraw(now) == 0){
+                frameDue = false;
+                lastRedraw = now;
+                return true;
+        }
+        return false;
+}
+
+int SimClock::steps_due(double now)
+{
+        if(substeps > 0){
+                // the steps of a frame are run when that frame becomes due
+                if(frameDue || until_redraw(now) > 0)
+                        return 0;
+                frameDue = true;
+                return substeps;
+        }
+
+        if(lastStep < 0)
+                lastStep = now;
+        owed += (now - lastStep) * rate;
+        lastStep = now;
+
+        int steps = (int)(owed / dt);
+        if(steps > maxSteps){
+                steps = maxSteps;
+                owed = 0;
+        } else{
+                owed -= steps * dt;
+        }
+        return steps;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Paces an interactive simulation independently of how often the window
+// system calls back. The simulation either advances a fixed number of
+// substeps per rendered frame, or follows the wall clock at a given rate
+// of simulated seconds per real second, and frames are only rendered at
+// up to a capped rate.
+class SimClock
+{
+public:
+    // substeps > 0 runs that many steps of dt per frame, otherwise the
+    // simulation runs at rate simulated seconds per wall clock second
+    SimClock(float dt, int substeps = 0, double rate = 1.0, double maxFps = 60.0);
+
+    // the number of steps to run now, given the wall clock time in seconds
+    int steps_due(double now);
+    // whether a frame should be rendered now. Once this returns true the
+    // next frame is due 1/maxFps seconds later.
+    bool redraw_due(double now);
+    // seconds until the next frame is due, 0 if it is due already
+    double until_redraw(double now);
+    // forgets the time that has passed, so that a paused simulation does not
+    // try to catch up when it is resumed
+    void restart(double now);
+
+    // seconds since some fixed point in the past
+    static double now();
+
+    float dt;
+    int substeps;
+    double rate;
+    double maxFps;
+    // at most this many steps per frame, so a slow simulation falls behind
+    // the wall clock instead of spending ever longer catching up
+    int maxSteps;
+
+private:
+    double lastStep;
+    double lastRedraw;
+    // simulated time owed to the wall clock
+    double owed;
+    bool frameDue;
+};
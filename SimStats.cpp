@@ -0,0 +1,164 @@
+#include "SimStats.h"
+#include <time.h>
+#include <stdlib.h>
+#include <math.h>
+#include <new>
+
+// every thread counts its own allocations, so those of the viewer or of
+// another simulation running at the same time do not show up in a System's
+// statistics
+static thread_local long allocationCount = 0;
+
+#ifdef SIM_PROFILE
+// count every allocation of the program while profiling
+void* operator new(size_t size)
+{
+    allocationCount++;
+    void* p = malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+    free(p);
+}
+#endif
+
+double profile_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+long profile_allocations()
+{
+    return allocationCount;
+}
+
+void profile_count_allocation()
+{
+#ifdef SIM_PROFILE
+    allocationCount++;
+#endif
+}
+
+#ifdef SIM_PROFILE
+static const bool profiled = true;
+#else
+// the timings and allocations were not gathered, so they are written as
+// missing rather than as zeros that look measured
+static const bool profiled = false;
+#endif
+
+// json has no nan or inf, so those are written as null
+static void print_json_number(FILE* fp, double value)
+{
+    if(isfinite(value))
+        fprintf(fp, "%g", value);
+    else
+        fprintf(fp, "null");
+}
+
+SimStats::SimStats()
+{
+    reset();
+}
+
+void SimStats::reset()
+{
+    for(int i = 0; i < NUM_PHASES; ++i){
+        phaseTime[i] = 0;
+        phaseCalls[i] = 0;
+    }
+    solves = 0;
+    iterations = 0;
+    lastIterations = 0;
+    lastResidual = 0;
+    maxResidual = 0;
+    failedSolves = 0;
+    allocations = 0;
+}
+
+void SimStats::add_time(int phase, double seconds)
+{
+    phaseTime[phase] += seconds;
+    phaseCalls[phase]++;
+}
+
+void SimStats::add_solve(int steps, double residual)
+{
+    solves++;
+    iterations += steps;
+    lastIterations = steps;
+    lastResidual = residual;
+    // a NaN residual is kept, and not passed over by a later one
+    if(isnan(residual) || residual > maxResidual)
+        maxResidual = residual;
+}
+
+const char* SimStats::phase_name(int phase)
+{
+    static const char* names[NUM_PHASES] = { "gravity", "springs", "assemble", "rhs",
+                                             "solve", "scatter", "writeback", "project" };
+    return names[phase];
+}
+
+void SimStats::print_csv(FILE* fp) const
+{
+    for(int i = 0; i < NUM_PHASES; ++i)
+        fprintf(fp, "%s_seconds,%s_calls,", phase_name(i), phase_name(i));
+    fprintf(fp, "solves,iterations,last_iterations,last_residual,max_residual,failed_solves,allocations\n");
+
+    for(int i = 0; i < NUM_PHASES; ++i){
+        if(profiled)
+            fprintf(fp, "%g,%ld,", phaseTime[i], phaseCalls[i]);
+        else
+            fprintf(fp, ",,");
+    }
+    fprintf(fp, "%ld,%ld,%d,%g,%g,%ld,", solves, iterations, lastIterations,
+            lastResidual, maxResidual, failedSolves);
+    if(profiled)
+        fprintf(fp, "%ld", allocations);
+    fprintf(fp, "\n");
+}
+
+void SimStats::print_json(FILE* fp) const
+{
+    fprintf(fp, "{\n  \"phases\": {\n");
+    for(int i = 0; i < NUM_PHASES; ++i){
+        fprintf(fp, "    \"%s\": { \"seconds\": ", phase_name(i));
+        if(profiled){
+            print_json_number(fp, phaseTime[i]);
+            fprintf(fp, ", \"calls\": %ld", phaseCalls[i]);
+        } else{
+            fprintf(fp, "null, \"calls\": null");
+        }
+        fprintf(fp, " }%s\n", i + 1 < NUM_PHASES ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+    fprintf(fp, "  \"solves\": %ld,\n  \"iterations\": %ld,\n  \"last_iterations\": %d,\n",
+            solves, iterations, lastIterations);
+    fprintf(fp, "  \"last_residual\": ");
+    print_json_number(fp, lastResidual);
+    fprintf(fp, ",\n  \"max_residual\": ");
+    print_json_number(fp, maxResidual);
+    fprintf(fp, ",\n");
+    fprintf(fp, "  \"failed_solves\": %ld,\n  \"allocations\": ", failedSolves);
+    if(profiled)
+        fprintf(fp, "%ld\n}\n", allocations);
+    else
+        fprintf(fp, "null\n}\n");
+}
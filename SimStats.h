@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdio.h>
+
+// Timings and counters of a System's derivative evaluations. The counters
+// of the constraint solves cost next to nothing and are kept in every
+// build. The timings and allocations are only gathered when built with
+// SIM_PROFILE defined (make PROFILE=1); otherwise the PROFILE_ macros
+// compile to nothing and they stay zero.
+
+#ifdef SIM_PROFILE
+#define PROFILE_START(t) double t = profile_clock()
+#define PROFILE_STOP(stats, phase, t) (stats).add_time(phase, profile_clock() - (t))
+#define PROFILE_ALLOCS(a) long a = profile_allocations()
+#define PROFILE_ADD_ALLOCS(stats, a) (stats).allocations += profile_allocations() - (a)
+#else
+#define PROFILE_START(t)
+#define PROFILE_STOP(stats, phase, t)
+#define PROFILE_ALLOCS(a)
+#define PROFILE_ADD_ALLOCS(stats, a)
+#endif
+
+// the phases of System::deriv_eval, and the projection of System::end_step
+enum ProfilePhase
+{
+    PHASE_GRAVITY,      // reset forces to gravity
+    PHASE_SPRINGS,      // accumulate spring forces
+    PHASE_ASSEMBLE,     // assemble J and set up the preconditioner
+    PHASE_RHS,          // assemble b
+    PHASE_SOLVE,        // conjugate gradient solve for lambda
+    PHASE_SCATTER,      // add the constraint forces J^T lambda
+    PHASE_WRITEBACK,    // write the derivatives
+    PHASE_PROJECT,      // XPBD projection at the end of a step
+    NUM_PHASES
+};
+
+class SimStats
+{
+public:
+    SimStats();
+
+    void reset();
+    void add_time(int phase, double seconds);
+    void add_solve(int steps, double residual);
+    static const char* phase_name(int phase);
+
+    // writes the statistics as a header line and one row of csv. Without
+    // SIM_PROFILE the timings and allocations are left empty, or null in json.
+    void print_csv(FILE* fp) const;
+    void print_json(FILE* fp) const;
+
+    // total seconds and number of times spent in each phase
+    double phaseTime[NUM_PHASES];
+    long phaseCalls[NUM_PHASES];
+    // conjugate gradient solves, those for the constraint forces and the
+    // implicit integrator's, their total iterations and the residual of
+    // the last solve and the worst solve
+    long solves;
+    long iterations;
+    int lastIterations;
+    double lastResidual;
+    double maxResidual;
+    // solves that ran out of steps before converging
+    long failedSolves;
+    // heap allocations made inside deriv_eval on the thread that called it
+    long allocations;
+};
+
+// seconds on a monotonic clock
+double profile_clock();
+// the number of heap allocations made so far by the calling thread; only
+// counted with SIM_PROFILE
+long profile_allocations();
+// records an allocation that does not go through operator new
+void profile_count_allocation();
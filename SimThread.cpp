@@ -0,0 +1,85 @@
+#include "SimThread.h"
+#include <unistd.h>
+
+// set on middle when it holds a frame the reader has not taken yet
+#define FRESH 4
+
+SimThread::SimThread(System * i_sys, Integrator * i_integrator, const SimClock & i_clock) :
+        sys(i_sys), integrator(i_integrator), simClock(i_clock),
+        quit(false), running(false), dirty(true), middle(1), back(0), front(2), haveFrame(false)
+{
+        thread = std::thread(&SimThread::run, this);
+}
+
+SimThread::~SimThread(void)
+{
+        quit = true;
+        thread.join();
+}
+
+void SimThread::set_running(bool i_running)
+{
+        running = i_running;
+}
+
+std::mutex & SimThread::mutex()
+{
+        return stateMutex;
+}
+
+void SimThread::mark_dirty()
+{
+        dirty = true;
+}
+
+SimClock & SimThread::clock()
+{
+        return simClock;
+}
+
+const std::vector<Vec2f> * SimThread::latest()
+{
+        if(middle.load() & FRESH){
+                front = middle.exchange(front) & ~FRESH;
+                haveFrame = true;
+        }
+        return haveFrame ? &buffers[front] : NULL;
+}
+
+void SimThread::publish()
+{
+        buffers[back] = sys->get_particles().position;
+        back = middle.exchange(back | FRESH) & ~FRESH;
+}
+
+void SimThread::run()
+{
+        while(!quit){
+                double now = SimClock::now();
+                int steps = 0;
+                {
+                        std::lock_guard<std::mutex> lock(stateMutex);
+                        if(running){
+                                steps = simClock.steps_due(now);
+                                // with a number of steps per frame, these steps make a frame
+                                if(steps > 0 && simClock.substeps > 0)
+                                        simClock.redraw_due(now);
+                        } else{
+                                simClock.restart(now);
+                        }
+                }
+                // the lock is taken step by step, so that the interface can get
+                // in between the steps of a long batch
+                for(int i = 0; i < steps && running && !quit; ++i){
+                        std::lock_guard<std::mutex> lock(stateMutex);
+                        integrator->step(*sys, simClock.dt);
+                }
+                if(steps > 0 || dirty.exchange(false)){
+                        std::lock_guard<std::mutex> lock(stateMutex);
+                        publish();
+                }
+                // let the other threads at the system until the next step is due
+                if(steps == 0)
+                        usleep(500);
+        }
+}
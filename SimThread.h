@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "System.h"
+#include "integrator.h"
+#include "SimClock.h"
+
+// Runs a System's simulation on a thread of its own. After every batch of
+// steps the particle positions are published into a triple buffer, from
+// which another thread, such as the GL thread, can take the latest
+// complete frame without waiting for the simulation.
+class SimThread
+{
+public:
+    // paces itself with a copy of the given clock
+    SimThread(System * i_sys, Integrator * i_integrator, const SimClock & i_clock);
+    // stops and joins the thread
+    ~SimThread(void);
+
+    // starts or pauses the stepping
+    void set_running(bool i_running);
+    // the most recently published positions, or NULL before the first
+    // frame. They stay valid until the next call from the same thread.
+    const std::vector<Vec2f> * latest();
+
+    // Held by the simulation during each step. Take it to change the system,
+    // or the clock below, from another thread, then call mark_dirty so the
+    // change is published even while the simulation is paused.
+    std::mutex & mutex();
+    void mark_dirty();
+    SimClock & clock();
+
+private:
+    SimThread(const SimThread &);
+    SimThread & operator=(const SimThread &);
+
+    void run();
+    void publish();
+
+    System * sys;
+    Integrator * integrator;
+    SimClock simClock;
+
+    std::thread thread;
+    std::mutex stateMutex;
+    std::atomic<bool> quit;
+    std::atomic<bool> running;
+    std::atomic<bool> dirty;
+
+    // the writer fills buffers[back] and swaps it with middle, the reader
+    // swaps front with middle when FRESH is set on it
+    std::vector<Vec2f> buffers[3];
+    std::atomic<int> middle;
+    int back;
+    int front;
+    bool haveFrame;
+};
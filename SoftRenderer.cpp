@@ -0,0 +1,169 @@
+#include "SoftRenderer.h"
+#include <math.h>
+#include <algorithm>
+
+#define PI 3.1415926535897932384626433832795
+// vertices of the polygon a wire is drawn as, as in Renderer
+#define WIRE_SEGMENTS 20
+
+// the colors Renderer draws with
+static const unsigned char SPRING_COLOR[3] = { 153, 179, 204 };
+static const unsigned char ROD_COLOR[3] = { 204, 179, 153 };
+static const unsigned char WIRE_COLOR[3] = { 0, 255, 0 };
+static const unsigned char PARTICLE_COLOR[3] = { 255, 255, 255 };
+
+SoftRenderer::SoftRenderer(int i_width, int i_height) :
+        antialias(true), width(i_width), height(i_height), pixels(4 * i_width * i_height)
+{
+}
+
+unsigned char * SoftRenderer::get_pixels()
+{
+        return &pixels[0];
+}
+
+int SoftRenderer::get_width() const
+{
+        return width;
+}
+
+int SoftRenderer::get_height() const
+{
+        return height;
+}
+
+void SoftRenderer::draw(System & sys, const std::vector<Vec2f> & position, float pointSize)
+{
+        // black and opaque
+        for(int i = 0; i < width * height; ++i){
+                pixels[4*i] = pixels[4*i+1] = pixels[4*i+2] = 0;
+                pixels[4*i+3] = 255;
+        }
+
+        int numPos = position.size();
+        const SpringStore & springs = sys.get_springs();
+        for(int s = 0; s < springs.size(); ++s){
+                if(springs.id1[s] < numPos && springs.id2[s] < numPos)
+                        draw_line(position[springs.id1[s]], position[springs.id2[s]], SPRING_COLOR);
+        }
+
+        const std::vector<RodConstraint*> & rods = sys.get_rodConst();
+        for(int r = 0; r < rods.size(); ++r){
+                if(rods[r]->get_id1() < numPos && rods[r]->get_id2() < numPos)
+                        draw_line(position[rods[r]->get_id1()], position[rods[r]->get_id2()], ROD_COLOR);
+        }
+
+        const std::vector<CircularWireConstraint*> & wires = sys.get_wireConst();
+        for(int w = 0; w < wires.size(); ++w){
+                Vec2f center = wires[w]->get_center();
+                double radius = wires[w]->get_radius();
+                for(int i = 0; i < WIRE_SEGMENTS; ++i){
+                        double a0 = 2 * PI * i / WIRE_SEGMENTS;
+                        double a1 = 2 * PI * (i + 1) / WIRE_SEGMENTS;
+                        draw_line(Vec2f(center[0] + cos(a0) * radius, center[1] + sin(a0) * radius),
+                                  Vec2f(center[0] + cos(a1) * radius, center[1] + sin(a1) * radius),
+                                  WIRE_COLOR);
+                }
+        }
+
+        for(int p = 0; p < numPos; ++p){
+                draw_point(position[p], pointSize, PARTICLE_COLOR);
+        }
+}
+
+void SoftRenderer::blend(int x, int y, float coverage, const unsigned char color[3])
+{
+        if(x < 0 || x >= width || y < 0 || y >= height || coverage <= 0)
+                return;
+        unsigned char * pixel = &pixels[4 * (y * width + x)];
+        for(int c = 0; c < 3; ++c){
+                pixel[c] = (unsigned char)(pixel[c] + (color[c] - pixel[c]) * coverage + 0.5f);
+        }
+}
+
+void SoftRenderer::draw_line(const Vec2f & a, const Vec2f & b, const unsigned char color[3])
+{
+        // to pixel coordinates, with the pixel centers on the integers
+        float x0 = (a[0] + 1) * 0.5f * width - 0.5f, y0 = (a[1] + 1) * 0.5f * height - 0.5f;
+        float x1 = (b[0] + 1) * 0.5f * width - 0.5f, y1 = (b[1] + 1) * 0.5f * height - 0.5f;
+        if(!(fabsf(x0) < 1e9f && fabsf(y0) < 1e9f && fabsf(x1) < 1e9f && fabsf(y1) < 1e9f))
+                return;
+
+        // clip to the image so a line far outside it costs nothing (Liang-Barsky)
+        float dx = x1 - x0, dy = y1 - y0;
+        float p[4] = { -dx, dx, -dy, dy };
+        float q[4] = { x0 + 1, width - x0, y0 + 1, height - y0 };
+        float t0 = 0, t1 = 1;
+        for(int k = 0; k < 4; ++k){
+                if(p[k] == 0){
+                        if(q[k] < 0)
+                                return;
+                        continue;
+                }
+                float t = q[k] / p[k];
+                if(p[k] < 0)
+                        t0 = std::max(t0, t);
+                else
+                        t1 = std::min(t1, t);
+        }
+        if(t0 > t1)
+                return;
+        x1 = x0 + t1 * dx;
+        y1 = y0 + t1 * dy;
+        x0 = x0 + t0 * dx;
+        y0 = y0 + t0 * dy;
+
+        // step along the longer axis, one pixel at a time
+        bool steep = fabsf(y1 - y0) > fabsf(x1 - x0);
+        if(steep){
+                std::swap(x0, y0);
+                std::swap(x1, y1);
+        }
+        if(x0 > x1){
+                std::swap(x0, x1);
+                std::swap(y0, y1);
+        }
+        float gradient = x1 == x0 ? 0 : (y1 - y0) / (x1 - x0);
+        int end = (int)floorf(x1 + 0.5f);
+        for(int x = (int)floorf(x0 + 0.5f); x <= end; ++x){
+                float y = y0 + gradient * (x - x0);
+                if(antialias){
+                        // the coverage is split between the two nearest pixels (Wu)
+                        int yi = (int)floorf(y);
+                        float f = y - yi;
+                        if(steep){
+                                blend(yi, x, 1 - f, color);
+                                blend(yi + 1, x, f, color);
+                        } else{
+                                blend(x, yi, 1 - f, color);
+                                blend(x, yi + 1, f, color);
+                        }
+                } else{
+                        int yi = (int)floorf(y + 0.5f);
+                        if(steep)
+                                blend(yi, x, 1, color);
+                        else
+                                blend(x, yi, 1, color);
+                }
+        }
+}
+
+void SoftRenderer::draw_point(const Vec2f & p, float size, const unsigned char color[3])
+{
+        float cx = (p[0] + 1) * 0.5f * width, cy = (p[1] + 1) * 0.5f * height;
+        if(!(fabsf(cx) < 1e9f && fabsf(cy) < 1e9f))
+                return;
+
+        // the pixels whose centers fall in the square, as GL_POINTS fills them
+        int side = std::max(1, (int)(size + 0.5f));
+        int x0 = (int)floorf(cx - 0.5f * side + 0.5f);
+        int y0 = (int)floorf(cy - 0.5f * side + 0.5f);
+        for(int y = std::max(y0, 0); y < std::min(y0 + side, height); ++y){
+                for(int x = std::max(x0, 0); x < std::min(x0 + side, width); ++x){
+                        unsigned char * pixel = &pixels[4 * (y * width + x)];
+                        pixel[0] = color[0];
+                        pixel[1] = color[1];
+                        pixel[2] = color[2];
+                }
+        }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include "System.h"
+
+// Draws a System into an RGBA image on the CPU, the way Renderer draws
+// it with OpenGL, so that runs without a display can write the same
+// frames. The image is stored bottom row first like glReadPixels
+// returns it, so it goes to saveImageRGBA and FrameStream unchanged.
+class SoftRenderer
+{
+public:
+    SoftRenderer(int i_width, int i_height);
+
+    // clears the image and draws sys with its particles at position.
+    // Particles are pointSize pixels wide.
+    void draw(System & sys, const std::vector<Vec2f> & position, float pointSize);
+
+    unsigned char * get_pixels();
+    int get_width() const;
+    int get_height() const;
+
+    // draws the lines anti-aliased, as GL_LINE_SMOOTH does (default true)
+    bool antialias;
+
+private:
+    // a line between two points of the [-1, 1] view
+    void draw_line(const Vec2f & a, const Vec2f & b, const unsigned char color[3]);
+    void draw_point(const Vec2f & p, float size, const unsigned char color[3]);
+    // mixes color into pixel (x, y) by coverage in [0, 1]
+    void blend(int x, int y, float coverage, const unsigned char color[3]);
+
+    int width, height;
+    std::vector<unsigned char> pixels;
+};
@@ -3,7 +3,7 @@
 
 #define DAMP 0.98f
 #define RAND (((rand()%2000)/1000.f)-1.f)
-void simulation_step( System sys, float dt )
+void simulation_step( System& sys, float dt )
 {
 
 	
@@ -0,0 +1,297 @@
+#include "SpringStore.h"
+#include <math.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+SpringStore::SpringStore(ParticleStore * i_particles) :
+        particles(i_particles), incidenceDirty(true), incidenceParticles(0)
+{
+}
+
+SpringStore::~SpringStore(void)
+{
+}
+
+int SpringStore::add(int i_id1, int i_id2, double i_dist, double i_ks, double i_kd)
+{
+        id1.push_back(i_id1);
+        id2.push_back(i_id2);
+        dist.push_back(i_dist);
+        ks.push_back(i_ks);
+        kd.push_back(i_kd);
+        incidenceDirty = true;
+        return size() - 1;
+}
+
+void SpringStore::pop()
+{
+        id1.pop_back();
+        id2.pop_back();
+        dist.pop_back();
+        ks.pop_back();
+        kd.pop_back();
+        incidenceDirty = true;
+}
+
+int SpringStore::size() const
+{
+        return id1.size();
+}
+
+void SpringStore::build_incidence()
+{
+        int n = size();
+        int numParticles = particles->size();
+
+        // count the springs of every particle, then turn the counts into offsets
+        incStart.assign(numParticles + 1, 0);
+        for(int s = 0; s < n; ++s){
+                incStart[id1[s] + 1]++;
+                incStart[id2[s] + 1]++;
+        }
+        for(int p = 0; p < numParticles; ++p){
+                incStart[p + 1] += incStart[p];
+        }
+
+        std::vector<int> fill(incStart.begin(), incStart.end() - 1);
+        incSpring.resize(2 * n);
+        for(int s = 0; s < n; ++s){
+                incSpring[fill[id1[s]]++] = s + 1;
+                incSpring[fill[id2[s]]++] = -(s + 1);
+        }
+
+        dx.resize(n);
+        dy.resize(n);
+        dvx.resize(n);
+        dvy.resize(n);
+        fx.resize(n);
+        fy.resize(n);
+
+        incidenceDirty = false;
+        incidenceParticles = numParticles;
+}
+
+// the force on the first particle of springs [begin, end), one at a time
+static void eval_springs(int begin, int end, const float * dx, const float * dy,
+                         const float * dvx, const float * dvy, const float * dist,
+                         const float * ks, const float * kd, float * fx, float * fy)
+{
+        for(int s = begin; s < end; ++s){
+                float len = sqrtf(dx[s]*dx[s] + dy[s]*dy[s]);
+                // so that if the particles are on top of eachother the program does not blow up
+                float inv = len == 0 ? 0 : 1.0f / len;
+                float v_dx = (dvx[s]*dx[s] + dvy[s]*dy[s]) * inv;
+                float mag = -((ks[s]*(len - dist[s]) + kd[s]*v_dx) * inv);
+                fx[s] = mag * dx[s];
+                fy[s] = mag * dy[s];
+        }
+}
+
+// the same as eval_springs over as many whole vectors of springs as fit in
+// n, returning the number of springs done
+static int eval_springs_simd(int n, const float * dx, const float * dy,
+                             const float * dvx, const float * dvy, const float * dist,
+                             const float * ks, const float * kd, float * fx, float * fy)
+{
+        int s = 0;
+#if defined(__AVX__)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        for(; s + 8 <= n; s += 8){
+                __m256 x = _mm256_loadu_ps(dx + s);
+                __m256 y = _mm256_loadu_ps(dy + s);
+                __m256 vx = _mm256_loadu_ps(dvx + s);
+                __m256 vy = _mm256_loadu_ps(dvy + s);
+                __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+                __m256 inv = _mm256_andnot_ps(_mm256_cmp_ps(len, zero, _CMP_EQ_OQ),
+                                              _mm256_div_ps(one, len));
+                __m256 v_dx = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vx, x), _mm256_mul_ps(vy, y)), inv);
+                __m256 spring = _mm256_mul_ps(_mm256_loadu_ps(ks + s),
+                                              _mm256_sub_ps(len, _mm256_loadu_ps(dist + s)));
+                __m256 damp = _mm256_mul_ps(_mm256_loadu_ps(kd + s), v_dx);
+                __m256 mag = _mm256_sub_ps(zero, _mm256_mul_ps(_mm256_add_ps(spring, damp), inv));
+                _mm256_storeu_ps(fx + s, _mm256_mul_ps(mag, x));
+                _mm256_storeu_ps(fy + s, _mm256_mul_ps(mag, y));
+        }
+#elif defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for(; s + 4 <= n; s += 4){
+                __m128 x = _mm_loadu_ps(dx + s);
+                __m128 y = _mm_loadu_ps(dy + s);
+                __m128 vx = _mm_loadu_ps(dvx + s);
+                __m128 vy = _mm_loadu_ps(dvy + s);
+                __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+                __m128 inv = _mm_andnot_ps(_mm_cmpeq_ps(len, zero), _mm_div_ps(one, len));
+                __m128 v_dx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(vx, x), _mm_mul_ps(vy, y)), inv);
+                __m128 spring = _mm_mul_ps(_mm_loadu_ps(ks + s), _mm_sub_ps(len, _mm_loadu_ps(dist + s)));
+                __m128 damp = _mm_mul_ps(_mm_loadu_ps(kd + s), v_dx);
+                __m128 mag = _mm_sub_ps(zero, _mm_mul_ps(_mm_add_ps(spring, damp), inv));
+                _mm_storeu_ps(fx + s, _mm_mul_ps(mag, x));
+                _mm_storeu_ps(fy + s, _mm_mul_ps(mag, y));
+        }
+#endif
+        return s;
+}
+
+namespace {
+
+class EvalTask : public ParallelTask
+{
+public:
+    EvalTask( SpringStore* i_springs ) : springs(i_springs) { }
+    virtual void run(int begin, int end, int thread) { springs->eval_forces(begin, end); }
+private:
+    SpringStore* springs;
+};
+
+class SumTask : public ParallelTask
+{
+public:
+    SumTask( SpringStore* i_springs ) : springs(i_springs) { }
+    virtual void run(int begin, int end, int thread) { springs->sum_forces(begin, end); }
+private:
+    SpringStore* springs;
+};
+
+}
+
+void SpringStore::add_forces(ThreadPool * pool)
+{
+        int n = size();
+        if(n == 0)
+                return;
+        if(incidenceDirty || incidenceParticles != particles->size())
+                build_incidence();
+
+        // springs only write their own force and particles only their own sum,
+        // so both passes split between threads without any locking
+        EvalTask eval(this);
+        SumTask sum(this);
+        if(pool){
+                pool->parallel_for(n, &eval);
+                pool->parallel_for(particles->size(), &sum);
+        } else{
+                eval_forces(0, n);
+                sum_forces(0, particles->size());
+        }
+}
+
+void SpringStore::eval_forces(int begin, int end)
+{
+        if(begin >= end)
+                return;
+
+        // gather the differences across every spring into contiguous arrays
+        const std::vector<Vec2f> & position = particles->position;
+        const std::vector<Vec2f> & velocity = particles->velocity;
+        for(int s = begin; s < end; ++s){
+                int i = id1[s], j = id2[s];
+                dx[s] = position[i][0] - position[j][0];
+                dy[s] = position[i][1] - position[j][1];
+                dvx[s] = velocity[i][0] - velocity[j][0];
+                dvy[s] = velocity[i][1] - velocity[j][1];
+        }
+
+        int done = begin + eval_springs_simd(end - begin, &dx[begin], &dy[begin], &dvx[begin],
+                                             &dvy[begin], &dist[begin], &ks[begin], &kd[begin],
+                                             &fx[begin], &fy[begin]);
+        eval_springs(done, end, &dx[0], &dy[0], &dvx[0], &dvy[0], &dist[0],
+                     &ks[0], &kd[0], &fx[0], &fy[0]);
+}
+
+void SpringStore::sum_forces(int begin, int end)
+{
+        // every particle sums the forces of its own springs
+        std::vector<Vec2f> & forces = particles->forces;
+        for(int p = begin; p < end; ++p){
+                float sumX = 0, sumY = 0;
+                for(int k = incStart[p]; k < incStart[p + 1]; ++k){
+                        int s = incSpring[k];
+                        if(s > 0){
+                                sumX += fx[s - 1];
+                                sumY += fy[s - 1];
+                        } else{
+                                sumX -= fx[-s - 1];
+                                sumY -= fy[-s - 1];
+                        }
+                }
+                forces[p][0] += sumX;
+                forces[p][1] += sumY;
+        }
+}
+
+void SpringStore::set_jacobians()
+{
+        int n = size();
+        if(incidenceDirty || incidenceParticles != particles->size())
+                build_incidence();
+
+        kxx.resize(n);
+        kxy.resize(n);
+        kyy.resize(n);
+        vxx.resize(n);
+        vxy.resize(n);
+        vyy.resize(n);
+
+        const std::vector<Vec2f> & position = particles->position;
+        for(int s = 0; s < n; ++s){
+                Vec2 d = Vec2(position[id1[s]]) - Vec2(position[id2[s]]);
+                double len = norm(d);
+                if(len == 0){
+                        kxx[s] = kxy[s] = kyy[s] = 0;
+                        vxx[s] = vxy[s] = vyy[s] = 0;
+                        continue;
+                }
+                Vec2 u = d / len;
+                double uxx = u[0]*u[0], uxy = u[0]*u[1], uyy = u[1]*u[1];
+
+                // ks * (u u^T + (1 - rest/len) (I - u u^T))
+                double t = len > dist[s] ? 1.0 - dist[s] / len : 0.0;
+                kxx[s] = ks[s] * (uxx + t * (1.0 - uxx));
+                kxy[s] = ks[s] * (uxy - t * uxy);
+                kyy[s] = ks[s] * (uyy + t * (1.0 - uyy));
+
+                // kd * u u^T
+                vxx[s] = kd[s] * uxx;
+                vxy[s] = kd[s] * uxy;
+                vyy[s] = kd[s] * uyy;
+        }
+}
+
+void SpringStore::jacobian_mult(double mass, double damping, double stiffness,
+                                const double y[], double r[])
+{
+        int numParticles = particles->size();
+        const std::vector<double> & invMass = particles->invMass;
+
+        // a spring adds K (y_p - y_other) to each of its particles
+        for(int p = 0; p < numParticles; ++p){
+                double rx = mass * y[2*p] / invMass[p];
+                double ry = mass * y[2*p+1] / invMass[p];
+                for(int k = incStart[p]; k < incStart[p + 1]; ++k){
+                        int s = incSpring[k];
+                        int other;
+                        if(s > 0){
+                                s = s - 1;
+                                other = id2[s];
+                        } else{
+                                s = -s - 1;
+                                other = id1[s];
+                        }
+                        double ex = y[2*p] - y[2*other];
+                        double ey = y[2*p+1] - y[2*other+1];
+                        double bxx = damping * vxx[s] + stiffness * kxx[s];
+                        double bxy = damping * vxy[s] + stiffness * kxy[s];
+                        double byy = damping * vyy[s] + stiffness * kyy[s];
+                        rx += bxx * ex + bxy * ey;
+                        ry += bxy * ex + byy * ey;
+                }
+                r[2*p] = rx;
+                r[2*p+1] = ry;
+        }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include "ParticleStore.h"
+#include "ThreadPool.h"
+
+/**
+ * Packed storage for every spring in a system. A spring is the pair of
+ * particle indices it joins together with its rest length and constants,
+ * kept in parallel arrays so the forces of all springs can be evaluated
+ * several at a time with SSE or AVX.
+ */
+class SpringStore
+{
+public:
+        SpringStore(ParticleStore * i_particles);
+        ~SpringStore(void);
+
+        // adds a spring between particles i_id1 and i_id2 and returns its index
+        int add(int i_id1, int i_id2, double i_dist, double i_ks, double i_kd);
+        // removes the most recently added spring
+        void pop();
+        int size() const;
+
+        // adds the force of every spring to the particles' force accumulators,
+        // splitting the work between the threads of pool when one is given
+        void add_forces(ThreadPool * pool = NULL);
+
+        // the two passes of add_forces: evaluates the forces of springs
+        // [begin, end), then sums them into the forces of particles [begin, end)
+        void eval_forces(int begin, int end);
+        void sum_forces(int begin, int end);
+
+        // computes the Jacobians of every spring's force at the current state,
+        // kept as the symmetric 2x2 blocks Kx = -df1/dx1 and Kv = -df1/dv1.
+        // Kx drops the transverse term of compressed springs so that it stays
+        // positive semi-definite, as in Baraff and Witkin's cloth solver.
+        void set_jacobians();
+        // r = mass*M y + (damping*Kv + stiffness*Kx) y over two doubles per
+        // particle, where M is the diagonal of masses and Kv, Kx are the
+        // assembled spring Jacobians from set_jacobians
+        void jacobian_mult(double mass, double damping, double stiffness,
+                           const double y[], double r[]);
+
+        ParticleStore * const particles;
+        std::vector<int> id1;
+        std::vector<int> id2;
+        std::vector<float> dist;   // rest length
+        std::vector<float> ks, kd; // spring strength constants
+
+private:
+
+        // lists the springs touching each particle, see incSpring
+        void build_incidence();
+
+        // per spring differences of the positions and velocities of the two
+        // particles, and the resulting force on the first particle
+        std::vector<float> dx, dy, dvx, dvy, fx, fy;
+
+        // the Jacobian blocks of every spring as xx, xy, yy entries
+        std::vector<double> kxx, kxy, kyy;
+        std::vector<double> vxx, vxy, vyy;
+
+        // the springs of particle p are incSpring[incStart[p]..incStart[p+1]),
+        // stored as s+1 where p is the spring's first particle and -(s+1)
+        // where it is the second. Summing per particle needs no two springs
+        // to write the same force at once.
+        std::vector<int> incStart;
+        std::vector<int> incSpring;
+        bool incidenceDirty;
+        int incidenceParticles;
+};
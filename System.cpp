@@ -2,61 +2,84 @@
 #include "linearSolver.h"
 
 
-System::System(std::vector<Particle*> i_pVector, std::vector<SpringForce*> i_forceVector,
-std::vector<CircularWireConstraint*> i_wireConstVector, std::vector<RodConstraint*> i_rodConstVector) :
-	pVector(i_pVector),
-	forceVector(i_forceVector),
-	wireConstVector(i_wireConstVector), 
-	rodConstVector(i_rodConstVector)
+System::System(PreconditionerType precondType) :
+        springs(&particles), workspace(precondType), pool(NULL),
+        constraintMode(CONSTRAINT_LAGRANGE)
 {
 }
 
 System::~System(void)
 {
+        delete pool;
 }
 
-void System::deriv_eval(std::vector<Particle*>& o_pVector){
-        int size = pVector.size();
-        int num_f = forceVector.size();
+void System::deriv_eval(std::vector<Vec2f>& o_derivPosition, std::vector<Vec2f>& o_derivVelocity){
+        int size = particles.size();
+        PROFILE_ALLOCS(allocs);
 	
         // reset forces to just gravity
+        PROFILE_START(t_gravity);
         for(int i = 0; i < size; ++i){
-            pVector[i]->forces = Vec2f(0.0, -G);
+            particles.forces[i] = Vec2f(0.0, -G);
         }
+        PROFILE_STOP(stats, PHASE_GRAVITY, t_gravity);
 	
         // add spring forces
-        for(int i = 0; i < num_f; ++i){
-                forceVector[i]->add_force();
-	}
+        PROFILE_START(t_springs);
+        springs.add_forces(pool);
+        PROFILE_STOP(stats, PHASE_SPRINGS, t_springs);
 
+        if(constraintMode == CONSTRAINT_LAGRANGE)
+                add_constraint_forces();
+
+        // set the derivative of position to the velocity and
+        // the derivative of the velocity to the total force divided by the mass
+        PROFILE_START(t_writeback);
+        o_derivPosition.resize(size);
+        o_derivVelocity.resize(size);
+        for(int i = 0; i < size; ++i){
+            o_derivPosition[i] = particles.velocity[i];
+            o_derivVelocity[i] = particles.forces[i] * particles.invMass[i];
+        }
+        PROFILE_STOP(stats, PHASE_WRITEBACK, t_writeback);
+        PROFILE_ADD_ALLOCS(stats, allocs);
+}
+
+void System::add_constraint_forces(){
         int num_wC = wireConstVector.size();
         int num_const = num_wC + rodConstVector.size();
-        // initialize matrix
-        implicitMatrix* JWJ_t = new implicitMatrixImpl(wireConstVector, rodConstVector);
+        // assemble the sparse constraint Jacobian J and the masses W
+        PROFILE_START(t_assemble);
+        implicitMatrixImpl* JWJ_t = &workspace.JWJ_t;
+        JWJ_t->assemble(wireConstVector, rodConstVector, particles);
+        if(workspace.precond)
+            workspace.precond->setup(JWJ_t);
+        PROFILE_STOP(stats, PHASE_ASSEMBLE, t_assemble);
 
-        double* lambda = (double*) malloc(num_const*sizeof(double));
-        double* b = (double*) malloc(num_const*sizeof(double));
+        double* lambda = workspace.lambda;
+        double* b = workspace.b;
 
-        // Calculate b
-        for(int i = 0; i < num_const; ++i){
-            lambda[i] = 0;
+        // -JWQ
+        PROFILE_START(t_rhs);
+        JWJ_t->jwMult(particles.forces, b);
+        vecTimesScalar(num_const, b, -1.0);
 
-            // -(Jdot)*(qdot)
+        // Calculate the rest of b
+        for(int i = 0; i < num_const; ++i){
+            // warm start from the multipliers of the previous solve
             if(i < num_wC){
-                b[i] = -wireConstVector[i]->get_Jdot() * pVector[ wireConstVector[i]->get_id() ]->Velocity;
+                lambda[i] = wireConstVector[i]->get_lambda();
             } else{
-                b[i] = -rodConstVector[i - num_wC]->get_Jdot() *
-                       (pVector[ rodConstVector[i - num_wC]->get_id1() ]->Velocity -
-                        pVector[ rodConstVector[i - num_wC]->get_id2() ]->Velocity);
+                lambda[i] = rodConstVector[i - num_wC]->get_lambda();
             }
 
-            // -JWQ
+            // -(Jdot)*(qdot)
             if(i < num_wC){
-                b[i] -= wireConstVector[i]->get_J() * pVector[ wireConstVector[i]->get_id() ]->forces;
+                b[i] -= wireConstVector[i]->get_Jdot() * particles.velocity[ wireConstVector[i]->get_id() ];
             } else{
-                b[i] -= rodConstVector[i - num_wC]->get_J() *
-                       (pVector[ rodConstVector[i - num_wC]->get_id1() ]->forces -
-                        pVector[ rodConstVector[i - num_wC]->get_id2() ]->forces);
+                b[i] -= rodConstVector[i - num_wC]->get_Jdot() *
+                       (particles.velocity[ rodConstVector[i - num_wC]->get_id1() ] -
+                        particles.velocity[ rodConstVector[i - num_wC]->get_id2() ]);
             }
 
             // -ks*C
@@ -74,84 +97,162 @@ void System::deriv_eval(std::vector<Particle*>& o_pVector){
             }
 
         }
+        PROFILE_STOP(stats, PHASE_RHS, t_rhs);
 
+        // solve to a tolerance relative to b, so the test means the same
+        // whatever the size of the forces
+        PROFILE_START(t_solve);
+        double epsilon = std::max(SOLVE_TOLERANCE * vecSqrLen(num_const, b), EPSILON);
         int steps = MAX_STEPS;
-        double err = ConjGrad(num_const, JWJ_t, lambda, b, EPSILON, &steps);
-        if(err > EPSILON){
-            printf("probably too many constraints to satisfy!!/n");
-            exit(0);
-        }
+        double err = ConjGrad(num_const, JWJ_t, lambda, b, epsilon, &steps, &workspace, workspace.precond);
+        PROFILE_STOP(stats, PHASE_SOLVE, t_solve);
+        // carry on with the best multipliers found rather than stopping the run
+        record_solve("constraint", steps, err, epsilon);
 
-        // calculate J_t*lambda and add those constraint forces
+        // remember the multipliers for the next solve
+        PROFILE_START(t_scatter);
         for(int i = 0; i < num_const; ++i){
             if(i < num_wC){
-                pVector[ wireConstVector[i]->get_id() ]->forces += wireConstVector[i]->get_J() * lambda[i];
+                wireConstVector[i]->set_lambda(lambda[i]);
             } else{
-                pVector[ rodConstVector[i - num_wC]->get_id1() ]->forces += rodConstVector[i - num_wC]->get_J() * lambda[i];
-                pVector[ rodConstVector[i - num_wC]->get_id2() ]->forces -= rodConstVector[i - num_wC]->get_J() * lambda[i];
+                rodConstVector[i - num_wC]->set_lambda(lambda[i]);
             }
         }
 
-        // set the derivative of position to the velocity and
-        // the derivative of the velocity to the total force divided by the mass
-        for(int i = 0; i < size; ++i){
-            pVector[i]->deriv_position = pVector[i]->Velocity;
-            pVector[i]->deriv_velocity = pVector[i]->forces / pVector[i]->mass;
-        }
+        // calculate J_t*lambda and add those constraint forces
+        JWJ_t->jtMultAdd(lambda, particles.forces);
+        PROFILE_STOP(stats, PHASE_SCATTER, t_scatter);
+}
 
-        free(lambda);
-        free(b);
-        delete JWJ_t;
+ParticleStore& System::get_particles(){
+        return particles;
+}
 
-        // return particle vector with the derivatives
-        o_pVector = pVector;
+Particle System::get_particle(int i){
+        return Particle(&particles, i);
 }
 
-void System::get_state(std::vector<Particle*>& o_pVector){
-        o_pVector = pVector;
+Particle System::add_particle(const Vec2f& ConstructPos, double mass){
+        return Particle(&particles, particles.add(ConstructPos, mass));
 }
 
-void System::set_state(std::vector<Particle*> i_pVector){
-        pVector = i_pVector;
+void System::pop_particle(){
+        particles.pop();
 }
 
-void System::get_forces(std::vector<SpringForce*>& o_forceVector){
-        o_forceVector = forceVector;
+void System::reset(){
+        particles.reset();
+
+        // the cached multipliers belong to the old motion
+        for(int i = 0; i < wireConstVector.size(); ++i){
+            wireConstVector[i]->set_lambda(0);
+        }
+        for(int i = 0; i < rodConstVector.size(); ++i){
+            rodConstVector[i]->set_lambda(0);
+        }
 }
 
-void System::get_rodConst(std::vector<RodConstraint*>& o_rodConstVector){
-        o_rodConstVector = rodConstVector;
+SpringStore& System::get_springs(){
+        return springs;
 }
 
-void System::get_wireConst(std::vector<CircularWireConstraint*>& o_wireConstVector){
-        o_wireConstVector = wireConstVector;
+const std::vector<RodConstraint*>& System::get_rodConst(){
+        return rodConstVector;
 }
 
-void System::add_springForce(SpringForce* f){
-    forceVector.push_back(f);
+const std::vector<CircularWireConstraint*>& System::get_wireConst(){
+        return wireConstVector;
+}
+
+int System::add_springForce(const Particle& p1, const Particle& p2, double dist, double ks, double kd){
+    return springs.add(p1.id, p2.id, dist, ks, kd);
 }
 
 void System::pop_springForce(){
-    forceVector.pop_back();
+    springs.pop();
 }
 
 void System::add_rodConst(RodConstraint* rod){
     rodConstVector.push_back(rod);
+    workspace.resize(wireConstVector.size() + rodConstVector.size());
 }
 
 void System::pop_rodConst(){
     rodConstVector.pop_back();
+    workspace.resize(wireConstVector.size() + rodConstVector.size());
 }
 
 void System::add_wireConst(CircularWireConstraint* wire){
     wireConstVector.push_back(wire);
+    workspace.resize(wireConstVector.size() + rodConstVector.size());
 }
 
 void System::pop_wireConst(){
     wireConstVector.pop_back();
+    workspace.resize(wireConstVector.size() + rodConstVector.size());
+}
+
+const SimStats& System::get_stats(){
+        return stats;
+}
+
+void System::reset_stats(){
+        stats.reset();
+}
+
+void System::record_solve(const char* name, int steps, double residual, double epsilon){
+        stats.add_solve(steps, residual);
+        if(!(residual <= epsilon)){
+            if(stats.failedSolves == 0)
+                printf("the %s solve did not converge in %d steps (residual %g), carrying on\n",
+                       name, steps, residual);
+            stats.failedSolves++;
+        }
+}
+
+void System::set_threads(int n){
+        delete pool;
+        pool = n > 1 ? new ThreadPool(n) : NULL;
+        workspace.setPool(pool);
+}
+
+int System::get_threads(){
+        return pool ? pool->size() : 1;
+}
+
+void System::set_constraint_mode(ConstraintMode mode, int iterations, double compliance){
+        constraintMode = mode;
+        if(mode != CONSTRAINT_LAGRANGE)
+                positionSolver.mode = mode;
+        positionSolver.iterations = iterations;
+        positionSolver.compliance = compliance;
+        // the accelerations integrators keep were worked out under the old mode
+        particles.touch();
+}
+
+ConstraintMode System::get_constraint_mode(){
+        return constraintMode;
+}
+
+void System::begin_step(){
+        if(constraintMode != CONSTRAINT_LAGRANGE)
+                positionSolver.begin(particles);
+}
+
+void System::end_step(float dt){
+        if(constraintMode != CONSTRAINT_LAGRANGE){
+                PROFILE_START(t_project);
+                positionSolver.project(particles, wireConstVector, rodConstVector, dt);
+                particles.touch();
+                PROFILE_STOP(stats, PHASE_PROJECT, t_project);
+        }
+}
+
+ThreadPool* System::get_pool(){
+        return pool;
 }
 
 int System::size(){
-        return pVector.size();
+        return particles.size();
 }
 
@@ -3,12 +3,20 @@
 #include <gfx/vec2.h>
 #include <vector>
 #include <stdlib.h>
+#include "ParticleStore.h"
+#include "Particle.h"
 #include "CircularWireConstraint.h"
 #include "RodConstraint.h"
-#include "SpringForce.h"
+#include "SpringStore.h"
+#include "linearSolver.h"
+#include "SimStats.h"
+#include "ThreadPool.h"
+#include "PositionSolver.h"
 
 #define G 0.003f
 #define EPSILON 1.0e-30
+// the constraint solve stops once |r|^2 <= SOLVE_TOLERANCE |b|^2
+#define SOLVE_TOLERANCE 1.0e-12
 #define Ks 100.0f
 #define Kd 100.0f
 
@@ -16,19 +24,26 @@ class System
 {
 public:
 
-        System(std::vector<Particle*> pVector, std::vector<SpringForce*> forceVector,
-                std::vector<CircularWireConstraint*> wireConstVector,
-                std::vector<RodConstraint*> rodConstVector);
+        // precondType selects the preconditioner of the constraint solve
+        System(PreconditionerType precondType = PRECOND_ICHOL);
         ~System(void);
 
-        void deriv_eval(std::vector<Particle*> &);
-        void get_state(std::vector<Particle*> &);
-        void get_forces(std::vector<SpringForce*> &);
-        void get_rodConst(std::vector<RodConstraint*> &);
-        void get_wireConst(std::vector<CircularWireConstraint*> &);
-        void set_state(std::vector<Particle*>);
-        // allow for adding spring forces after initialization
-        void add_springForce(SpringForce*);
+        // computes the derivatives of every particle's position and velocity
+        // into the given buffers, which are resized to the number of particles
+        void deriv_eval(std::vector<Vec2f> & o_derivPosition, std::vector<Vec2f> & o_derivVelocity);
+        ParticleStore & get_particles();
+        Particle get_particle(int i);
+        // adds a particle to the system and returns a handle to it
+        Particle add_particle(const Vec2f & ConstructPos, double mass);
+        void pop_particle();
+        // puts every particle back at its construction position
+        void reset();
+        SpringStore & get_springs();
+        const std::vector<RodConstraint*> & get_rodConst();
+        const std::vector<CircularWireConstraint*> & get_wireConst();
+        // allow for adding spring forces after initialization, returns the
+        // spring's index in get_springs()
+        int add_springForce(const Particle & p1, const Particle & p2, double dist, double ks, double kd);
         // allow for adding rod constraints after initialization
         void add_rodConst(RodConstraint*);
         // allow for adding wire constraints after initialization
@@ -37,12 +52,44 @@ public:
         void pop_rodConst();
         void pop_wireConst();
         int size();
+        // splits the forces and the constraint solve between n threads, 1 runs it all on the calling thread
+        void set_threads(int n);
+        int get_threads();
+        // the pool of worker threads, NULL when running on a single thread
+        ThreadPool* get_pool();
+        // selects how the rods and wires are enforced. The XPBD modes leave
+        // the constraint forces out of deriv_eval and instead project the
+        // positions in end_step with the given number of iterations.
+        void set_constraint_mode(ConstraintMode mode, int iterations = 10, double compliance = 0);
+        ConstraintMode get_constraint_mode();
+        // called around every step of an integrator, see Integrator::step
+        void begin_step();
+        void end_step(float dt);
+        // counters of deriv_eval's solves, and its timings when built with SIM_PROFILE
+        const SimStats & get_stats();
+        void reset_stats();
+        // counts a conjugate gradient solve of the step, and a failed one when
+        // its residual did not get below epsilon; name goes in the warning
+        void record_solve(const char* name, int steps, double residual, double epsilon);
 
 private:
 
-        std::vector<Particle*> pVector;
-        std::vector<SpringForce*> forceVector;
+        // the system owns its particles, so it must not be copied
+        System(const System &);
+        System & operator=(const System &);
+
+        // adds the forces of the rods and wires from the Lagrange multipliers
+        void add_constraint_forces();
+
+        ParticleStore particles;
+        SpringStore springs;
         std::vector<CircularWireConstraint*> wireConstVector;
         std::vector<RodConstraint*> rodConstVector;
+        // buffers of the constraint solve, sized to the number of constraints
+        SolverWorkspace workspace;
+        SimStats stats;
+        ThreadPool* pool;
+        ConstraintMode constraintMode;
+        PositionSolver positionSolver;
 	
 };
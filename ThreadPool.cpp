@@ -0,0 +1,94 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int numThreads) :
+        task(NULL), n(0), numChunks(0), generation(0), pending(0), quit(false)
+{
+        for(int t = 1; t < numThreads; ++t){
+                threads.push_back(std::thread(&ThreadPool::worker, this, t));
+        }
+}
+
+ThreadPool::~ThreadPool(void)
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+        }
+        start.notify_all();
+        for(int t = 0; t < threads.size(); ++t){
+                threads[t].join();
+        }
+}
+
+int ThreadPool::size() const
+{
+        return threads.size() + 1;
+}
+
+void ThreadPool::chunk(int n, int numChunks, int t, int* begin, int* end)
+{
+        *begin = (int)((long long)n * t / numChunks);
+        *end = (int)((long long)n * (t + 1) / numChunks);
+}
+
+void ThreadPool::parallel_for(int n, ParallelTask* task, int minChunk)
+{
+        int chunks = size();
+        if(minChunk > 0 && n / minChunk < chunks)
+                chunks = n / minChunk;
+        if(chunks <= 1){
+                if(n > 0)
+                        task->run(0, n, 0);
+                return;
+        }
+
+        {
+                std::lock_guard<std::mutex> lock(mutex);
+                this->task = task;
+                this->n = n;
+                numChunks = chunks;
+                pending = chunks - 1;
+                ++generation;
+        }
+        start.notify_all();
+
+        // the calling thread takes the first chunk
+        int begin, end;
+        chunk(n, chunks, 0, &begin, &end);
+        task->run(begin, end, 0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while(pending > 0)
+                done.wait(lock);
+}
+
+void ThreadPool::worker(int thread)
+{
+        unsigned long seen = 0;
+        for(;;){
+                ParallelTask* myTask;
+                int myN, myChunks;
+                {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        while(!quit && generation == seen)
+                                start.wait(lock);
+                        if(quit)
+                                return;
+                        seen = generation;
+                        myTask = task;
+                        myN = n;
+                        myChunks = numChunks;
+                }
+
+                // threads beyond the chunks of a short loop sit it out
+                if(thread < myChunks){
+                        int begin, end;
+                        chunk(myN, myChunks, thread, &begin, &end);
+                        myTask->run(begin, end, thread);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if(--pending == 0)
+                                done.notify_one();
+                }
+        }
+}
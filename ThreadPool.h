@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * A range of work that can be split between threads. run() is called with
+ * disjoint [begin, end) ranges that together cover the whole range, and
+ * thread is the index of the calling thread in the pool.
+ */
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() { }
+    virtual void run(int begin, int end, int thread) = 0;
+};
+
+/**
+ * A fixed set of worker threads that share loops with the calling thread.
+ * The split of a loop depends only on its length and the number of
+ * threads, so the same loop is always divided the same way.
+ */
+class ThreadPool
+{
+public:
+    // numThreads counts the calling thread, so 1 runs everything inline
+    ThreadPool(int numThreads);
+    ~ThreadPool(void);
+
+    int size() const;
+
+    // runs task over [0, n) in one contiguous chunk per thread and returns
+    // when every chunk is done. Loops shorter than minChunk per thread use
+    // fewer threads.
+    void parallel_for(int n, ParallelTask* task, int minChunk = 1024);
+
+    // the chunk of [0, n) that thread t of numChunks runs
+    static void chunk(int n, int numChunks, int t, int* begin, int* end);
+
+private:
+
+    ThreadPool(const ThreadPool &);
+    ThreadPool & operator=(const ThreadPool &);
+
+    void worker(int thread);
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+
+    // the loop being run, published under mutex
+    ParallelTask* task;
+    int n;
+    int numChunks;
+    // bumped for every loop so that workers can tell a new loop from a spurious wake
+    unsigned long generation;
+    int pending;
+    bool quit;
+};
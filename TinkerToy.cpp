@@ -2,13 +2,21 @@
 //
 
 #include "Particle.h"
-#include "imageio.h"
+#include "FrameDumper.h"
 #include "System.h"
 #include "integrator.h"
+#include "scene.h"
+#include "SimClock.h"
+#include "SimThread.h"
+#include "Renderer.h"
+#include "Trajectory.h"
 
 #include <vector>
+#include <algorithm>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <GLUT/glut.h>
 
 /* macros */
@@ -22,9 +30,6 @@ static int dsim;
 static int dump_frames;
 static int frame_number;
 
-// static Particle *pList;
-static std::vector<Particle*> pVector;
-
 static int win_id;
 static int win_x, win_y;
 static int mouse_down[3];
@@ -34,12 +39,29 @@ static int omx, omy, mx, my;
 static int hmx, hmy;
 // flag for whether the mouse has already been registered as being down
 static bool clicked;
+// whether the paused system has been put back at its construction positions
+static bool remapped;
 
-static std::vector<SpringForce*> forceVector;
-static std::vector<RodConstraint*> rodConstVector;
-static std::vector<CircularWireConstraint*> wireConstVector;
 static Integrator* integrator;
 static System* sys = NULL;
+static SimClock* simClock = NULL;
+// steps the simulation on its own thread, NULL when it runs in idle_func
+static SimThread* simThread = NULL;
+// draws the system, created with the window
+static Renderer* renderer = NULL;
+// writes the dumped frames on threads of its own
+static FrameDumper* frameDumper = NULL;
+// where the frames go instead of pngs when given -stream
+static FrameStream* frameStream = NULL;
+// how the dumped pngs are encoded
+static PngOptions pngOptions;
+// inverse stiffness of the rods and wires under XPBD, given by -compliance
+static double compliance = 0;
+// a recorded run played back instead of simulated, given by -play
+static TrajectoryReader* trajectory = NULL;
+// simulated seconds into the recording, and the wall clock it was last advanced at
+static double playTime, playWall;
+static std::vector<Vec2f> playPosition;
 
 /*
 ----------------------------------------------------------------------
@@ -49,79 +71,48 @@ free/clear/allocate simulation data
 
 static void free_data ( void )
 {
-    pVector.clear();
-    forceVector.clear();
-    wireConstVector.clear();
-    rodConstVector.clear();
+    delete simThread;
+    delete frameDumper;
+    delete frameStream;
+    delete renderer;
+    delete trajectory;
     delete sys;
     delete integrator;
+    delete simClock;
 }
 
 static void clear_data ( void )
 {
-        sys->get_state( pVector );
-	int ii, size = pVector.size();
-
-	for(ii=0; ii<size; ii++){
-		pVector[ii]->reset();
-	}
+        if ( trajectory ) {
+                playTime = 0;
+        } else if ( simThread ) {
+                std::lock_guard<std::mutex> lock( simThread->mutex() );
+                sys->reset();
+                simThread->mark_dirty();
+        } else {
+                sys->reset();
+        }
 }
 
 static void init_system( void )
 {
         clicked = false;
-        const double dist = 0.1;
-        const Vec2f center(-0.5, 0.5);
-        const Vec2f x_offset(dist, 0.0);
-        const Vec2f y_offset(0.0, -dist);
 
         // Create an array of 100 particles connected by warp, weft and shear springs.
         // Then connect these to two particles constrained to a circular wire
+        sys = new System();
+        if ( trajectory )
+                trajectory->build(sys);
+        else
+                build_cloth(sys);
+}
 
-        // add particles
-        for(int i = 0; i < 10; ++i){
-            for(int k = 0; k < 10; ++k){
-                pVector.push_back(new Particle(center + k*x_offset + i*y_offset, 1.f, i*10 + k));
-            }
-        }
-
-        // the two anchor particles
-        pVector.push_back(new Particle(center - 2*x_offset - y_offset, 3.f, 100));
-        pVector.push_back(new Particle(center + 11*x_offset - y_offset, 3.f, 101));
-
-        // the anchor particles constraints and spring forces
-        wireConstVector.push_back(new CircularWireConstraint(pVector[100], center - 3*x_offset - y_offset, dist));
-        wireConstVector.push_back(new CircularWireConstraint(pVector[101], center + 12*x_offset - y_offset, dist));
-        forceVector.push_back(new SpringForce(pVector[100], pVector[0], 2*dist, 10.f, 1.f));
-        forceVector.push_back(new SpringForce(pVector[101], pVector[9], 2*dist, 10.f, 1.f));
-
-        // add a rod constraint or spring force between alternating particles in the first row
-        for(int i = 0; i < 9; ++i){
-            if(i%2 == 0)
-                rodConstVector.push_back(new RodConstraint(pVector[i], pVector[i+1], dist));
-            else
-                forceVector.push_back(new SpringForce(pVector[i], pVector[i+1], dist, 4.f, 1.f));
-        }
-
-        for(int i = 0; i < 9; ++i){
-            for(int k = 0; k < 10; ++k){
-                if(k != 9){
-                    // weft springs
-                    forceVector.push_back(new SpringForce(pVector[10*i + k + 10], pVector[10*i + k + 11], dist, 4.f, 1.f));
-                    // shear springs
-                    forceVector.push_back(new SpringForce(pVector[10*i + k + 10], pVector[10*i + k + 1], sqrt(2)*dist, 4.f, 1.0f));
-                }
-                if(k != 0){
-                    // shear springs
-                    forceVector.push_back(new SpringForce(pVector[10*i + k + 10], pVector[10*i + k - 1], sqrt(2)*dist, 4.f, 1.f));
-                }
-                // warp springs
-                forceVector.push_back(new SpringForce(pVector[10*i + k + 10], pVector[10*i + k], dist, 4.f, 1.f));
-
-            }
-        }
-	
-        sys = new System(pVector, forceVector, wireConstVector, rodConstVector);
+// the frame of the recording at playTime
+static int play_frame ( void )
+{
+        double frameTime = trajectory->frame_time() > 0 ? trajectory->frame_time() : dt;
+        int frame = (int)(playTime / frameTime + 0.5);
+        return std::max( 0, std::min( frame, trajectory->num_frames() - 1 ) );
 }
 
 /*
@@ -145,70 +136,34 @@ static void post_display ( void )
 	// Write frames if necessary.
 	if (dump_frames) {
                 const int FRAME_INTERVAL = 24;
-		if ((frame_number % FRAME_INTERVAL) == 0) {
+		// a stream takes every frame, the pngs one in FRAME_INTERVAL
+		if (frameStream || (frame_number % FRAME_INTERVAL) == 0) {
 			const unsigned int w = glutGet(GLUT_WINDOW_WIDTH);
 			const unsigned int h = glutGet(GLUT_WINDOW_HEIGHT);
-                        unsigned char * buffer = (unsigned char *) malloc(w * h * 4 * sizeof(unsigned char));
-			if (!buffer)
-				exit(-1);
-			// glRasterPos2i(0, 0);
-			glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
-			char filename[13];
+			char filename[32];
 			sprintf(filename, "img%.5i.png", frame_number / FRAME_INTERVAL);
-			printf("Dumped %s.\n", filename);
-			saveImageRGBA(filename, buffer, w, h);
+			// read back and written to disk while the next frames are drawn
+			frameDumper->capture(filename, w, h);
 		}
 	}
+	frameDumper->collect();
 	frame_number++;
 	
 	glutSwapBuffers ();
 }
 
-static void draw_particles ( void )
-{
-        sys->get_state( pVector );
-	int size = pVector.size();
-
-	for(int ii=0; ii< size; ii++)
-	{
-		pVector[ii]->draw();
-	}
-}
-
-static void draw_forces ( void )
-{
-    sys->get_forces( forceVector );
-    int size = forceVector.size();
-
-    for(int ii=0; ii< size; ii++)
-    {
-        forceVector[ii]->draw();
-    }
-}
-
-static void draw_constraints ( void )
-{
-    sys->get_rodConst( rodConstVector );
-    sys->get_wireConst( wireConstVector );
-    int rodSize = rodConstVector.size();
-    int wireSize = wireConstVector.size();
-
-    for(int ii=0; ii< rodSize; ii++)
-    {
-        rodConstVector[ii]->draw();
-    }
-    for(int ii=0; ii< wireSize; ii++)
-    {
-        wireConstVector[ii]->draw();
-    }
-}
-
 /*
 ----------------------------------------------------------------------
 relates mouse movements to tinker toy construction
 ----------------------------------------------------------------------
 */
 
+// whether the mouse is adding or dragging a particle, or has let go of one
+static bool has_UI_input ()
+{
+	return mouse_down[0] || ( mouse_release[0] && clicked );
+}
+
 static void get_from_UI ()
 {
 	int i, j;
@@ -228,24 +183,17 @@ static void get_from_UI ()
             if(!clicked){
                 // add a particle at the position of the mouse.
                 // then add two spring particles to the top of the "cloth"
-                std::vector<Particle*> p;
-                p.resize(sys->size());
-                sys->get_state( p );
                 // have to convert the mouse location from pixel coordinates to window coordinates
-                p.push_back(new Particle(Vec2f(2.f*mx/(double)win_x - 1.f,
-                                               1.f - 2.f*my/(double)win_y), 1.f, sys->size()));
-                sys->set_state( p );
-                sys->add_springForce(new SpringForce(p[4], p[sys->size() - 1], 0.2f, 0.1f, 0.05f));
-                sys->add_springForce(new SpringForce(p[5], p[sys->size() - 1], 0.2f, 0.1f, 0.05f));
+                Particle p = sys->add_particle(Vec2f(2.f*mx/(double)win_x - 1.f,
+                                                     1.f - 2.f*my/(double)win_y), 1.f);
+                sys->add_springForce(sys->get_particle(4), p, 0.2f, 0.1f, 0.05f);
+                sys->add_springForce(sys->get_particle(5), p, 0.2f, 0.1f, 0.05f);
                 clicked = true;
             } else{
                 // reposition the particle to the new location of the mouse
-                std::vector<Particle*> p;
-                p.resize(sys->size());
-                sys->get_state( p );
-                p[sys->size() - 1]->Position = Vec2f(2.f*mx/(double)win_x - 1.f,
-                                                     1.f - 2.f*my/(double)win_y);
-                sys->set_state( p );
+                sys->get_particle(sys->size() - 1).Position() = Vec2f(2.f*mx/(double)win_x - 1.f,
+                                                                      1.f - 2.f*my/(double)win_y);
+                sys->get_particles().touch();
             }
 	}
 
@@ -260,13 +208,9 @@ static void get_from_UI ()
             if(clicked){
                 // remove the particle and two springs
                 clicked = false;
-                std::vector<Particle*> p;
-                p.resize(sys->size());
-                sys->get_state( p );
-                p.pop_back();
-                sys->set_state( p );
                 sys->pop_springForce();
                 sys->pop_springForce();
+                sys->pop_particle();
             }
 	}
 
@@ -276,12 +220,14 @@ static void get_from_UI ()
 
 static void remap_GUI()
 {
-	int ii, size = pVector.size();
+	ParticleStore & particles = sys->get_particles();
+	int ii, size = particles.size();
 	for(ii=0; ii<size; ii++)
 	{
-		pVector[ii]->Position[0] = pVector[ii]->ConstructPos[0];
-		pVector[ii]->Position[1] = pVector[ii]->ConstructPos[1];
+		particles.position[ii][0] = particles.constructPos[ii][0];
+		particles.position[ii][1] = particles.constructPos[ii][1];
 	}
+	particles.touch();
 }
 
 /*
@@ -297,12 +243,78 @@ static void key_func ( unsigned char key, int x, int y )
 
         case ' ':
                 dsim = !dsim;
+                // a recording pauses where it is rather than starting over
+                if ( trajectory ) break;
 
 	case 'c':
 	case 'C':
 		clear_data ();
 		break;
 
+        case 'x':
+        case 'X':
+        {
+                // switch between the Lagrange multiplier solve and XPBD projection
+                std::unique_lock<std::mutex> lock;
+                if(simThread)
+                        lock = std::unique_lock<std::mutex>( simThread->mutex() );
+                if(sys->get_constraint_mode() == CONSTRAINT_LAGRANGE)
+                        sys->set_constraint_mode(CONSTRAINT_XPBD_GAUSS_SEIDEL, 10, compliance);
+                else
+                        sys->set_constraint_mode(CONSTRAINT_LAGRANGE);
+                printf("constraints: %s\n", sys->get_constraint_mode() == CONSTRAINT_LAGRANGE ? "lagrange" : "xpbd");
+                break;
+        }
+
+        case '+':
+        case '-':
+                // run the simulation faster or slower against the wall clock
+                if(simClock->substeps > 0){
+                        simClock->substeps = key == '+' ? simClock->substeps * 2 : (simClock->substeps + 1) / 2;
+                        printf("%d steps per frame\n", simClock->substeps);
+                } else{
+                        simClock->rate *= key == '+' ? 2.0 : 0.5;
+                        printf("%g simulated seconds per second\n", simClock->rate);
+                }
+                if(simThread){
+                        std::lock_guard<std::mutex> lock( simThread->mutex() );
+                        simThread->clock().substeps = simClock->substeps;
+                        simThread->clock().rate = simClock->rate;
+                }
+                break;
+
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+        {
+                // step through the recording a frame, or a tenth of it, at a time
+                if(!trajectory)
+                        break;
+                double frameTime = trajectory->frame_time() > 0 ? trajectory->frame_time() : dt;
+                int frames = (key == '[' || key == ']') ? 1 : std::max(1, trajectory->num_frames() / 10);
+                int frame = play_frame() + (key == '[' || key == '{' ? -frames : frames);
+                frame = std::max(0, std::min(frame, trajectory->num_frames() - 1));
+                playTime = frame * frameTime;
+                printf("frame %d of %d\n", frame, trajectory->num_frames());
+                break;
+        }
+
+        case 't':
+        case 'T':
+                // move the simulation onto its own thread or back into idle_func
+                if(trajectory)
+                        break;
+                if(simThread){
+                        delete simThread;
+                        simThread = NULL;
+                        simClock->restart( SimClock::now() );
+                } else{
+                        simThread = new SimThread( sys, integrator, *simClock );
+                }
+                printf("simulation on %s thread\n", simThread ? "its own" : "the GL");
+                break;
+
 	case 'd':
 	case 'D':
 		dump_frames = !dump_frames;
@@ -345,23 +357,61 @@ static void reshape_func ( int width, int height )
 
 static void idle_func ( void )
 {
-    if ( dsim ){
-        integrator->integrate( *sys, dt );
+    double now = SimClock::now();
+
+    if ( trajectory ) {
+        // the recording plays back against the wall clock, as fast as it was simulated
+        if ( dsim ) {
+            double frameTime = trajectory->frame_time() > 0 ? trajectory->frame_time() : dt;
+            playTime += (now - playWall) * simClock->rate;
+            playTime = std::min( playTime, (trajectory->num_frames() - 1) * frameTime );
+        }
+        playWall = now;
+    } else if ( simThread ) {
+        // the simulation steps itself, only the interface is handled here,
+        // and its lock is only taken when there is a change to hand over
+        simThread->set_running( dsim );
+        if ( dsim ) remapped = false;
+        if ( dsim ? has_UI_input() : !remapped ) {
+            std::lock_guard<std::mutex> lock( simThread->mutex() );
+            if ( dsim ) get_from_UI();
+            else        remap_GUI();
+            simThread->mark_dirty();
+            remapped = !dsim;
+        }
+    } else if ( dsim ){
+        int steps = simClock->steps_due( now );
+        for(int i = 0; i < steps; ++i){
+            integrator->step( *sys, dt );
+        }
         get_from_UI();
     }
-    else        {remap_GUI();}
-
-    glutSetWindow ( win_id );
-    glutPostRedisplay ();
+    else        {remap_GUI(); simClock->restart( now );}
+
+    if ( simClock->redraw_due( now ) ) {
+        glutSetWindow ( win_id );
+        glutPostRedisplay ();
+    } else {
+        // nothing to draw yet, so give the processor back for a moment
+        double wait = simClock->until_redraw( now );
+        usleep( (useconds_t)(1e6 * (wait < 0.001 ? wait : 0.001)) );
+    }
 }
 
 static void display_func ( void )
 {
 	pre_display ();
 
-	draw_forces();
-	draw_constraints();
-	draw_particles();
+	const std::vector<Vec2f> * position = &sys->get_particles().position;
+	if ( trajectory ) {
+		// read straight from the mapped file
+		trajectory->get_frame( play_frame(), playPosition );
+		position = &playPosition;
+	} else if ( simThread )
+		position = simThread->latest();
+	// particles are 0.03 across in the [-1, 1] view
+	if ( position )
+		renderer->draw( *sys, *position, 0.015f * win_x );
 
 	post_display ();
 }
@@ -380,6 +430,9 @@ static void open_glut_window ( void )
 	glutInitWindowPosition ( 0, 0 );
 	glutInitWindowSize ( win_x, win_y );
 	win_id = glutCreateWindow ( "Tinkertoys!" );
+	renderer = new Renderer();
+	frameDumper = new FrameDumper( 2, 8, frameStream );
+	frameDumper->set_png_options( pngOptions );
 
 	glClearColor ( 0.0f, 0.0f, 0.0f, 1.0f );
 	glClear ( GL_COLOR_BUFFER_BIT );
@@ -411,35 +464,59 @@ int main ( int argc, char ** argv )
 {
 	glutInit ( &argc, argv );
 
-	if( argc < 2 ){
-                printf("Usage: ./%s integrator=(1-euler, 2-RK2, 3-sympleticEuler, 4-RK4) [N dt d]", argv[0]);
+	// dumped pngs are written fast rather than small unless asked otherwise,
+	// and without the alpha channel as the background is opaque
+	pngOptions.compressionLevel = 1;
+	pngOptions.filters = PNG_FILTER_NONE;
+	pngOptions.rgb = true;
+
+	// take out the options, leaving the positional arguments
+	const char * streamTarget = NULL;
+	const char * playTarget = NULL;
+	int numArgs = 1;
+	for ( int i = 1; i < argc; ++i ) {
+		if ( !strcmp( argv[i], "-stream" ) && i + 1 < argc )
+			streamTarget = argv[++i];
+		else if ( !strcmp( argv[i], "-play" ) && i + 1 < argc )
+			playTarget = argv[++i];
+		else if ( !strcmp( argv[i], "-png-level" ) && i + 1 < argc )
+			pngOptions.compressionLevel = atoi( argv[++i] );
+		else if ( !strcmp( argv[i], "-png-filter" ) && i + 1 < argc ) {
+			const char * filter = argv[++i];
+			if ( !strcmp( filter, "none" ) )        pngOptions.filters = PNG_FILTER_NONE;
+			else if ( !strcmp( filter, "sub" ) )    pngOptions.filters = PNG_FILTER_SUB;
+			else if ( !strcmp( filter, "up" ) )     pngOptions.filters = PNG_FILTER_UP;
+			else if ( !strcmp( filter, "avg" ) )    pngOptions.filters = PNG_FILTER_AVG;
+			else if ( !strcmp( filter, "paeth" ) )  pngOptions.filters = PNG_FILTER_PAETH;
+			else                                    pngOptions.filters = PNG_ALL_FILTERS;
+		}
+		else if ( !strcmp( argv[i], "-png-rgba" ) )
+			pngOptions.rgb = false;
+		else if ( !strcmp( argv[i], "-compliance" ) && i + 1 < argc )
+			compliance = atof( argv[++i] );
+		else
+			argv[numArgs++] = argv[i];
+	}
+	argc = numArgs;
+
+	if( argc < 2 && !playTarget ){
+                printf("Usage: ./%s integrator=(1-euler, 2-RK2, 3-sympleticEuler, 4-RK4, 5-implicitEuler, 6-adaptiveRK45, 7-velocityVerlet, 8-leapfrog) [N dt d [substeps fps]]\n", argv[0]);
+                printf("\tsubsteps is the number of steps per frame, 0 to follow the wall clock (default)\n");
+                printf("\tfps caps the frames drawn per second (default 60)\n");
+                printf("\t-stream FILE appends every dumped frame to FILE, as Y4M if it ends in .y4m\n");
+                printf("\t             and as raw RGBA otherwise. -stream '|command' pipes Y4M to command\n");
+                printf("\t-png-level L zlib level of the dumped pngs, 0-9 (default 1)\n");
+                printf("\t-png-filter F row filters of the dumped pngs, none, sub, up, avg, paeth or all (default none)\n");
+                printf("\t-png-rgba    keeps the alpha channel in the dumped pngs\n");
+                printf("\t-play FILE   plays back a trajectory recorded by simrun instead of simulating\n");
+                printf("\t-compliance C inverse stiffness of the rods and wires under XPBD, 0 for rigid (default 0)\n");
 		exit(0);
 	}
 	
         // decide which integrator to use
-        switch ( argv[1][0] )
-        {
-        case '1':
-            integrator = new EulerIntegrator();
-            break;
-
-        case '2':
-            integrator = new RK2Integrator();
-            break;
-
-        case '3':
-            integrator = new SymplecticEulerIntegrator();
-            break;
-
-        case '4':
-            integrator = new RK4Integrator();
-            break;
-
-        default:
-            integrator = new RK4Integrator();
-        }
+        integrator = create_integrator( argc > 1 ? argv[1][0] : '4' );
 	
-	if ( argc == 2 ) {
+	if ( argc <= 2 ) {
 		N = 64;
                 dt = 0.01f;
 		d = 5.f;
@@ -451,16 +528,47 @@ int main ( int argc, char ** argv )
 		d = atof(argv[4]);
 	}
 
+        // steps follow the wall clock unless a number per frame is given
+        simClock = new SimClock( dt );
+        if ( argc > 5 )
+                simClock->substeps = atoi(argv[5]);
+        if ( argc > 6 )
+                simClock->maxFps = atof(argv[6]);
+
+        if ( streamTarget ) {
+                // an uncapped frame rate is written as the stream's default rate
+                frameStream = new FrameStream( streamTarget, (int)(simClock->maxFps + 0.5) );
+                if ( !frameStream->is_open() )
+                        exit(-1);
+        }
+
 	printf ( "\n\nHow to use this application:\n\n" );
 	printf ( "\t Toggle construction/simulation display with the spacebar key\n" );
 	printf ( "\t Dump frames by pressing the 'd' key\n" );
+	printf ( "\t Switch the constraints between Lagrange multipliers and XPBD with the 'x' key\n" );
+	printf ( "\t Speed the simulation up or down with the '+' and '-' keys\n" );
+	printf ( "\t Move the simulation on or off its own thread with the 't' key\n" );
+	printf ( "\t Step through a played back recording with '[' and ']', or a tenth at a time with '{' and '}'\n" );
 	printf ( "\t Quit by pressing the 'q' key\n" );
 
 	dsim = 0;
 	dump_frames = 0;
 	frame_number = 0;
 	
+        if ( playTarget ) {
+                trajectory = new TrajectoryReader( playTarget );
+                if ( !trajectory->is_open() )
+                        exit(-1);
+                if ( trajectory->num_frames() == 0 ) {
+                        printf("%s holds no frames\n", playTarget);
+                        exit(-1);
+                }
+                printf("playing %d frames of %d particles\n", trajectory->num_frames(), trajectory->num_particles());
+        }
+
 	init_system();
+        if ( !trajectory )
+                simThread = new SimThread( sys, integrator, *simClock );
 	
         win_x = 720;
         win_y = 720;
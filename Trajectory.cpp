@@ -0,0 +1,365 @@
+#include "Trajectory.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TRAJECTORY_VERSION 1
+
+// the sizes of the topology records, see Trajectory.h
+#define PARTICLE_BYTES 12
+#define SPRING_BYTES 20
+#define ROD_BYTES 12
+#define WIRE_BYTES 16
+
+// IEEE half precision, rounded to nearest even
+static uint16_t float_to_half(float f)
+{
+        uint32_t x;
+        memcpy(&x, &f, 4);
+        uint32_t sign = (x >> 16) & 0x8000;
+        int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+        uint32_t mant = x & 0x7fffff;
+
+        if(((x >> 23) & 0xff) == 0xff)
+                return sign | 0x7c00 | (mant ? 0x200 : 0);
+        if(exp >= 31)
+                return sign | 0x7c00;
+        if(exp <= 0){
+                // too small for a normal half, so a subnormal or zero
+                if(exp < -10)
+                        return sign;
+                mant |= 0x800000;
+                int shift = 14 - exp;
+                uint32_t h = mant >> shift;
+                uint32_t rem = mant & ((1u << shift) - 1);
+                uint32_t halfway = 1u << (shift - 1);
+                if(rem > halfway || (rem == halfway && (h & 1)))
+                        h++;
+                return sign | h;
+        }
+        uint32_t h = sign | (exp << 10) | (mant >> 13);
+        uint32_t rem = mant & 0x1fff;
+        // a carry out of the mantissa correctly bumps the exponent
+        if(rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+                h++;
+        return h;
+}
+
+static float half_to_float(uint16_t h)
+{
+        uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+        int exp = (h >> 10) & 0x1f;
+        uint32_t mant = h & 0x3ff;
+        uint32_t x;
+
+        if(exp == 0){
+                if(mant == 0){
+                        x = sign;
+                } else{
+                        // normalise the subnormal
+                        exp = 1;
+                        while(!(mant & 0x400)){
+                                mant <<= 1;
+                                exp--;
+                        }
+                        mant &= 0x3ff;
+                        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+                }
+        } else if(exp == 31){
+                x = sign | 0x7f800000 | (mant << 13);
+        } else{
+                x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+        }
+        float f;
+        memcpy(&f, &x, 4);
+        return f;
+}
+
+static size_t topology_bytes(const TrajectoryHeader & header)
+{
+        return (size_t)header.numParticles * PARTICLE_BYTES + (size_t)header.numSprings * SPRING_BYTES +
+               (size_t)header.numRods * ROD_BYTES + (size_t)header.numWires * WIRE_BYTES;
+}
+
+static size_t frame_bytes(const TrajectoryHeader & header)
+{
+        size_t values = 2 * header.numParticles * ((header.flags & TRAJECTORY_VELOCITIES) ? 2 : 1);
+        return values * (header.encoding == TRAJECTORY_FLOAT16 ? 2 : 4);
+}
+
+// a record of the topology, assembled field by field
+class Record
+{
+public:
+    void put_int(int32_t i) { bytes.insert(bytes.end(), (const char *)&i, (const char *)&i + 4); }
+    void put_float(float f) { bytes.insert(bytes.end(), (const char *)&f, (const char *)&f + 4); }
+    std::vector<char> bytes;
+};
+
+TrajectoryWriter::TrajectoryWriter(const char * filename, System & sys, double frameTime,
+                                   TrajectoryEncoding encoding, bool velocities)
+{
+        ParticleStore & particles = sys.get_particles();
+        SpringStore & springs = sys.get_springs();
+        const std::vector<RodConstraint*> & rods = sys.get_rodConst();
+        const std::vector<CircularWireConstraint*> & wires = sys.get_wireConst();
+
+        memcpy(header.magic, "TTRJ", 4);
+        header.version = TRAJECTORY_VERSION;
+        header.numParticles = particles.size();
+        header.numSprings = springs.size();
+        header.numRods = rods.size();
+        header.numWires = wires.size();
+        header.encoding = encoding;
+        header.flags = velocities ? TRAJECTORY_VELOCITIES : 0;
+        header.frameTime = frameTime;
+
+        fp = fopen(filename, "wb");
+        if(!fp){
+                printf("could not open %s\n", filename);
+                return;
+        }
+
+        Record topology;
+        for(int p = 0; p < particles.size(); ++p){
+                topology.put_float(1.0 / particles.invMass[p]);
+                topology.put_float(particles.constructPos[p][0]);
+                topology.put_float(particles.constructPos[p][1]);
+        }
+        for(int s = 0; s < springs.size(); ++s){
+                topology.put_int(springs.id1[s]);
+                topology.put_int(springs.id2[s]);
+                topology.put_float(springs.dist[s]);
+                topology.put_float(springs.ks[s]);
+                topology.put_float(springs.kd[s]);
+        }
+        for(int r = 0; r < rods.size(); ++r){
+                topology.put_int(rods[r]->get_id1());
+                topology.put_int(rods[r]->get_id2());
+                topology.put_float(rods[r]->get_dist());
+        }
+        for(int w = 0; w < wires.size(); ++w){
+                topology.put_int(wires[w]->get_id());
+                topology.put_float(wires[w]->get_center()[0]);
+                topology.put_float(wires[w]->get_center()[1]);
+                topology.put_float(wires[w]->get_radius());
+        }
+
+        fwrite(&header, sizeof(header), 1, fp);
+        if(!topology.bytes.empty())
+                fwrite(&topology.bytes[0], 1, topology.bytes.size(), fp);
+}
+
+TrajectoryWriter::~TrajectoryWriter(void)
+{
+        if(fp)
+                fclose(fp);
+}
+
+bool TrajectoryWriter::is_open() const
+{
+        return fp != NULL;
+}
+
+bool TrajectoryWriter::write_frame(System & sys)
+{
+        if(!fp)
+                return false;
+
+        // the positions of all particles, then their velocities
+        ParticleStore & particles = sys.get_particles();
+        int n = header.numParticles;
+        values.resize(2 * n * ((header.flags & TRAJECTORY_VELOCITIES) ? 2 : 1));
+        for(int p = 0; p < n; ++p){
+                values[2*p] = particles.position[p][0];
+                values[2*p+1] = particles.position[p][1];
+        }
+        if(header.flags & TRAJECTORY_VELOCITIES){
+                for(int p = 0; p < n; ++p){
+                        values[2*n + 2*p] = particles.velocity[p][0];
+                        values[2*n + 2*p+1] = particles.velocity[p][1];
+                }
+        }
+
+        if(values.empty())
+                return true;
+        size_t written;
+        if(header.encoding == TRAJECTORY_FLOAT16){
+                halves.resize(values.size());
+                for(int i = 0; i < values.size(); ++i){
+                        halves[i] = float_to_half(values[i]);
+                }
+                written = fwrite(&halves[0], 2, halves.size(), fp);
+        } else{
+                written = fwrite(&values[0], 4, values.size(), fp);
+        }
+        if(written != values.size()){
+                printf("could not write a trajectory frame\n");
+                return false;
+        }
+        return true;
+}
+
+TrajectoryReader::TrajectoryReader(const char * filename) :
+        map(NULL), mapSize(0), header(NULL), frames(NULL), frameBytes(0), numFrames(0)
+{
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0){
+                printf("could not open %s\n", filename);
+                return;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TrajectoryHeader)){
+                printf("%s is not a trajectory\n", filename);
+                close(fd);
+                return;
+        }
+        void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED){
+                printf("could not map %s\n", filename);
+                return;
+        }
+        map = (const unsigned char *)data;
+        mapSize = st.st_size;
+
+        header = (const TrajectoryHeader *)map;
+        size_t start = sizeof(TrajectoryHeader) + topology_bytes(*header);
+        if(memcmp(header->magic, "TTRJ", 4) || header->version != TRAJECTORY_VERSION || mapSize < start){
+                printf("%s is not a trajectory\n", filename);
+                munmap((void *)map, mapSize);
+                map = NULL;
+                header = NULL;
+                return;
+        }
+        if(!valid_ids()){
+                printf("%s refers to particles it does not have\n", filename);
+                munmap((void *)map, mapSize);
+                map = NULL;
+                header = NULL;
+                return;
+        }
+        frames = map + start;
+        frameBytes = frame_bytes(*header);
+        // a frame cut short by a run that stopped is left out
+        numFrames = frameBytes ? (mapSize - start) / frameBytes : 0;
+}
+
+TrajectoryReader::~TrajectoryReader(void)
+{
+        if(map)
+                munmap((void *)map, mapSize);
+}
+
+bool TrajectoryReader::is_open() const
+{
+        return map != NULL;
+}
+
+int TrajectoryReader::num_frames() const
+{
+        return numFrames;
+}
+
+int TrajectoryReader::num_particles() const
+{
+        return header ? header->numParticles : 0;
+}
+
+double TrajectoryReader::frame_time() const
+{
+        return header ? header->frameTime : 0;
+}
+
+bool TrajectoryReader::has_velocities() const
+{
+        return header && (header->flags & TRAJECTORY_VELOCITIES);
+}
+
+bool TrajectoryReader::valid_ids() const
+{
+        int n = header->numParticles;
+        const unsigned char * data = map + sizeof(TrajectoryHeader) + (size_t)n * PARTICLE_BYTES;
+        for(int s = 0; s < header->numSprings; ++s, data += SPRING_BYTES){
+                int32_t id[2];
+                memcpy(id, data, sizeof(id));
+                if(id[0] < 0 || id[0] >= n || id[1] < 0 || id[1] >= n)
+                        return false;
+        }
+        for(int r = 0; r < header->numRods; ++r, data += ROD_BYTES){
+                int32_t id[2];
+                memcpy(id, data, sizeof(id));
+                if(id[0] < 0 || id[0] >= n || id[1] < 0 || id[1] >= n)
+                        return false;
+        }
+        for(int w = 0; w < header->numWires; ++w, data += WIRE_BYTES){
+                int32_t id;
+                memcpy(&id, data, sizeof(id));
+                if(id < 0 || id >= n)
+                        return false;
+        }
+        return true;
+}
+
+void TrajectoryReader::build(System * sys) const
+{
+        if(!header)
+                return;
+
+        const unsigned char * data = map + sizeof(TrajectoryHeader);
+        std::vector<Particle> particles;
+        for(int p = 0; p < header->numParticles; ++p, data += PARTICLE_BYTES){
+                float f[3];
+                memcpy(f, data, sizeof(f));
+                particles.push_back(sys->add_particle(Vec2f(f[1], f[2]), f[0]));
+        }
+        for(int s = 0; s < header->numSprings; ++s, data += SPRING_BYTES){
+                int32_t id[2];
+                float f[3];
+                memcpy(id, data, sizeof(id));
+                memcpy(f, data + 8, sizeof(f));
+                sys->add_springForce(particles[id[0]], particles[id[1]], f[0], f[1], f[2]);
+        }
+        for(int r = 0; r < header->numRods; ++r, data += ROD_BYTES){
+                int32_t id[2];
+                float dist;
+                memcpy(id, data, sizeof(id));
+                memcpy(&dist, data + 8, sizeof(dist));
+                sys->add_rodConst(new RodConstraint(particles[id[0]], particles[id[1]], dist));
+        }
+        for(int w = 0; w < header->numWires; ++w, data += WIRE_BYTES){
+                int32_t id;
+                float f[3];
+                memcpy(&id, data, sizeof(id));
+                memcpy(f, data + 4, sizeof(f));
+                sys->add_wireConst(new CircularWireConstraint(particles[id], Vec2f(f[0], f[1]), f[2]));
+        }
+}
+
+void TrajectoryReader::decode(const unsigned char * data, int n, std::vector<Vec2f> & out) const
+{
+        out.resize(n);
+        if(header->encoding == TRAJECTORY_FLOAT16){
+                const uint16_t * h = (const uint16_t *)data;
+                for(int i = 0; i < n; ++i){
+                        out[i] = Vec2f(half_to_float(h[2*i]), half_to_float(h[2*i+1]));
+                }
+        } else{
+                // Vec2f is two packed floats, the same as the file
+                if(n > 0)
+                        memcpy(&out[0], data, n * sizeof(Vec2f));
+        }
+}
+
+void TrajectoryReader::get_frame(int f, std::vector<Vec2f> & position, std::vector<Vec2f> * velocity) const
+{
+        if(f < 0 || f >= numFrames)
+                return;
+        int n = header->numParticles;
+        const unsigned char * data = frames + f * frameBytes;
+        decode(data, n, position);
+        if(velocity && has_velocities())
+                decode(data + frameBytes / 2, n, *velocity);
+}
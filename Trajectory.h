@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "System.h"
+
+// A trajectory file holds a run of a System: a header with its topology,
+// followed by one fixed size block per frame with the positions and
+// optionally the velocities of every particle. All values are stored in
+// the byte order of the machine that wrote the file.
+//
+//   TrajectoryHeader
+//   particles  numParticles x { float mass, constructX, constructY }
+//   springs    numSprings   x { int32 id1, id2; float dist, ks, kd }
+//   rods       numRods      x { int32 id1, id2; float dist }
+//   wires      numWires     x { int32 id; float centerX, centerY, radius }
+//   frames     { x, y of every particle; vx, vy of every particle }
+//
+// Frames are appended as the run goes, so the number of frames follows
+// from the size of the file and a run that stops early stays readable.
+
+enum TrajectoryEncoding
+{
+    TRAJECTORY_FLOAT32,
+    TRAJECTORY_FLOAT16      // half the size, to about 1e-3 of the view
+};
+
+// set in flags when the frames carry velocities
+#define TRAJECTORY_VELOCITIES 1
+
+struct TrajectoryHeader
+{
+    char magic[4];          // "TTRJ"
+    uint32_t version;
+    uint32_t numParticles, numSprings, numRods, numWires;
+    uint32_t encoding;      // a TrajectoryEncoding
+    uint32_t flags;
+    double frameTime;       // simulated seconds between frames
+};
+
+// Appends the frames of a run to a trajectory file.
+class TrajectoryWriter
+{
+public:
+    // writes the header and topology of sys, whose layout must not change
+    // while frames are written
+    TrajectoryWriter(const char * filename, System & sys, double frameTime,
+                     TrajectoryEncoding encoding = TRAJECTORY_FLOAT32, bool velocities = true);
+    ~TrajectoryWriter(void);
+
+    bool is_open() const;
+    // appends the current state of sys
+    bool write_frame(System & sys);
+
+private:
+    TrajectoryWriter(const TrajectoryWriter &);
+    TrajectoryWriter & operator=(const TrajectoryWriter &);
+
+    FILE * fp;
+    TrajectoryHeader header;
+    // one frame's values as written
+    std::vector<float> values;
+    std::vector<uint16_t> halves;
+};
+
+// Reads a trajectory file through a memory map, so opening a long run
+// costs nothing and any frame can be read straight away.
+class TrajectoryReader
+{
+public:
+    TrajectoryReader(const char * filename);
+    ~TrajectoryReader(void);
+
+    // false when the file could not be read, is not a trajectory, or its
+    // springs, rods or wires refer to particles it does not have
+    bool is_open() const;
+    int num_frames() const;
+    int num_particles() const;
+    double frame_time() const;
+    bool has_velocities() const;
+
+    // adds the particles, springs, rods and wires of the run to an empty sys
+    void build(System * sys) const;
+    // reads the positions and, when given and stored, velocities of frame f
+    void get_frame(int f, std::vector<Vec2f> & position, std::vector<Vec2f> * velocity = NULL) const;
+
+private:
+    TrajectoryReader(const TrajectoryReader &);
+    TrajectoryReader & operator=(const TrajectoryReader &);
+
+    // n pairs of encoded values from data into out
+    void decode(const unsigned char * data, int n, std::vector<Vec2f> & out) const;
+    // whether every particle id of the topology is one of its particles
+    bool valid_ids() const;
+
+    const unsigned char * map;
+    size_t mapSize;
+    const TrajectoryHeader * header;
+    const unsigned char * frames;
+    size_t frameBytes;
+    int numFrames;
+};
@@ -0,0 +1,336 @@
+// bench.cpp : Times the simulation's hot paths on generated scenes.
+//
+
+#include "System.h"
+#include "integrator.h"
+#include "scene.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+
+// every repetition runs for at least this many seconds
+#define MIN_REP_TIME 0.01
+
+static void usage ( const char * name )
+{
+        printf("Usage: %s [-min N] [-max N] [-reps R] [-dt DT] [-threads N] [-scene cloth|chain|both] [-out file.csv]\n", name);
+        exit(-1);
+}
+
+static double wall_time ( void )
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/**
+ * A piece of work to time. run() is called repeatedly and should leave
+ * the kernel ready to run again.
+ */
+class Kernel
+{
+public:
+    virtual ~Kernel() { }
+    // called before every repetition of run()
+    virtual void prepare() { }
+    virtual void run() = 0;
+    // the CG iterations taken by the last run, if any
+    virtual int iterations() { return 0; }
+};
+
+/**
+ * The positions and velocities of a system and the multipliers its
+ * constraint solve starts from, so that every repetition of a step can
+ * start from the same state and take the same number of iterations.
+ */
+struct Snapshot
+{
+    void save(System* sys)
+    {
+        position = sys->get_particles().position;
+        velocity = sys->get_particles().velocity;
+        const std::vector<CircularWireConstraint*>& wires = sys->get_wireConst();
+        const std::vector<RodConstraint*>& rods = sys->get_rodConst();
+        lambda.clear();
+        for(int i = 0; i < wires.size(); ++i)
+            lambda.push_back(wires[i]->get_lambda());
+        for(int i = 0; i < rods.size(); ++i)
+            lambda.push_back(rods[i]->get_lambda());
+    }
+    void restore(System* sys)
+    {
+        sys->get_particles().position = position;
+        sys->get_particles().velocity = velocity;
+        sys->get_particles().touch();
+        restore_multipliers(sys);
+    }
+    void restore_multipliers(System* sys)
+    {
+        const std::vector<CircularWireConstraint*>& wires = sys->get_wireConst();
+        const std::vector<RodConstraint*>& rods = sys->get_rodConst();
+        for(int i = 0; i < wires.size(); ++i)
+            wires[i]->set_lambda(lambda[i]);
+        for(int i = 0; i < rods.size(); ++i)
+            rods[i]->set_lambda(lambda[wires.size() + i]);
+    }
+    std::vector<Vec2f> position;
+    std::vector<Vec2f> velocity;
+    std::vector<double> lambda;
+};
+
+class SpringKernel : public Kernel
+{
+public:
+    SpringKernel( System* i_sys ) : sys(i_sys) { }
+    virtual void run()
+    {
+        ParticleStore& p = sys->get_particles();
+        for(int i = 0; i < p.size(); ++i)
+            p.forces[i] = Vec2f(0.0, 0.0);
+        sys->get_springs().add_forces(sys->get_pool());
+    }
+private:
+    System* sys;
+};
+
+class MatVecKernel : public Kernel
+{
+public:
+    MatVecKernel( SolverWorkspace* i_work ) : work(i_work) { }
+    virtual void run()
+    {
+        work->JWJ_t.matVecMult(work->b, work->temp);
+    }
+private:
+    SolverWorkspace* work;
+};
+
+class ConjGradKernel : public Kernel
+{
+public:
+    ConjGradKernel( SolverWorkspace* i_work ) : work(i_work), steps(0) { }
+    virtual void run()
+    {
+        int n = work->size();
+        for(int i = 0; i < n; ++i)
+            work->lambda[i] = 0;
+        // the same tolerance as the system's solve
+        double epsilon = std::max(SOLVE_TOLERANCE * vecSqrLen(n, work->b), EPSILON);
+        steps = MAX_STEPS;
+        ConjGrad(n, &work->JWJ_t, work->lambda, work->b, epsilon, &steps, work, work->precond);
+    }
+    virtual int iterations() { return steps; }
+private:
+    SolverWorkspace* work;
+    int steps;
+};
+
+class DerivKernel : public Kernel
+{
+public:
+    DerivKernel( System* i_sys, Snapshot* i_start ) : sys(i_sys), start(i_start), steps(0) { }
+    // the solve starts from the same multipliers every time, as it would
+    // otherwise start from its own answer and not iterate at all
+    virtual void run()
+    {
+        start->restore_multipliers(sys);
+        long before = sys->get_stats().iterations;
+        sys->deriv_eval(deriv_position, deriv_velocity);
+        steps = sys->get_stats().iterations - before;
+    }
+    virtual int iterations() { return steps; }
+private:
+    System* sys;
+    Snapshot* start;
+    std::vector<Vec2f> deriv_position;
+    std::vector<Vec2f> deriv_velocity;
+    int steps;
+};
+
+class StepKernel : public Kernel
+{
+public:
+    StepKernel( System* i_sys, Integrator* i_integrator, float i_dt, Snapshot* i_start ) :
+        sys(i_sys), integrator(i_integrator), dt(i_dt), start(i_start), steps(0) { }
+    virtual void prepare()
+    {
+        start->restore(sys);
+    }
+    // the iterations of every solve of the step
+    virtual void run()
+    {
+        long before = sys->get_stats().iterations;
+        integrator->step(*sys, dt);
+        steps = sys->get_stats().iterations - before;
+    }
+    virtual int iterations() { return steps; }
+private:
+    System* sys;
+    Integrator* integrator;
+    float dt;
+    Snapshot* start;
+    int steps;
+};
+
+/**
+ * Runs the kernel in repetitions of at least MIN_REP_TIME and returns the
+ * median time of one call in seconds.
+ */
+static double time_kernel( Kernel* kernel, int reps )
+{
+    // warm up and find how many calls fill one repetition
+    int calls = 1;
+    for(;;){
+        kernel->prepare();
+        double start = wall_time();
+        for(int i = 0; i < calls; ++i)
+            kernel->run();
+        if(wall_time() - start >= MIN_REP_TIME)
+            break;
+        calls *= 2;
+    }
+
+    std::vector<double> times;
+    for(int r = 0; r < reps; ++r){
+        kernel->prepare();
+        double start = wall_time();
+        for(int i = 0; i < calls; ++i)
+            kernel->run();
+        times.push_back((wall_time() - start) / calls);
+    }
+    std::sort(times.begin(), times.end());
+    return times[reps / 2];
+}
+
+static void report( FILE* csv, const char* scene, System* sys, const char* name,
+                    Kernel* kernel, int reps )
+{
+    double t = time_kernel(kernel, reps);
+    printf("%-6s %8d  %-26s %13.1f ns/call %9.2f ns/particle %4d iterations\n",
+           scene, sys->size(), name, t * 1e9, t * 1e9 / sys->size(), kernel->iterations());
+    if(csv)
+        fprintf(csv, "%s,%d,%s,%g,%g,%d\n", scene, sys->size(), name, t * 1e9,
+                t * 1e9 / sys->size(), kernel->iterations());
+}
+
+static void bench_scene( FILE* csv, const char* scene, int size, int reps, float dt, int threads )
+{
+    // the incomplete Cholesky preconditioner keeps long rod chains solvable
+    System* sys = new System(PRECOND_ICHOL);
+    if(!strcmp(scene, "chain")){
+        build_chain(sys, size);
+    } else{
+        int side = (int) sqrt((double) size);
+        build_cloth(sys, side, side);
+    }
+    sys->reset();
+    sys->set_threads(threads);
+
+    // move away from the rest state so that every term is exercised
+    Integrator* euler = create_integrator('1');
+    for(int i = 0; i < 2; ++i)
+        euler->step(*sys, dt);
+    delete euler;
+
+    // a copy of the system's constraint solve to time its pieces
+    SolverWorkspace work(PRECOND_ICHOL);
+    int num_const = sys->get_wireConst().size() + sys->get_rodConst().size();
+    work.resize(num_const);
+    work.setPool(sys->get_pool());
+    work.JWJ_t.assemble(sys->get_wireConst(), sys->get_rodConst(), sys->get_particles());
+    work.precond->setup(&work.JWJ_t);
+    for(int i = 0; i < num_const; ++i)
+        work.b[i] = sin(0.1 * i);
+
+    SpringKernel springs(sys);
+    report(csv, scene, sys, "SpringStore::add_forces", &springs, reps);
+    MatVecKernel matVec(&work);
+    report(csv, scene, sys, "matVecMult", &matVec, reps);
+    ConjGradKernel conjGrad(&work);
+    report(csv, scene, sys, "ConjGrad", &conjGrad, reps);
+    // every evaluation and every integrator starts from the same state
+    Snapshot start;
+    start.save(sys);
+    DerivKernel deriv(sys, &start);
+    report(csv, scene, sys, "deriv_eval", &deriv, reps);
+
+    const char* keys = "12345678";
+    const char* names[] = { "EulerIntegrator", "RK2Integrator",
+                            "SymplecticEulerIntegrator", "RK4Integrator",
+                            "ImplicitEulerIntegrator", "AdaptiveRK45Integrator",
+                            "VelocityVerletIntegrator", "LeapfrogIntegrator" };
+    for(int k = 0; keys[k]; ++k){
+        Integrator* integrator = create_integrator(keys[k]);
+        StepKernel step(sys, integrator, dt, &start);
+        report(csv, scene, sys, names[k], &step, reps);
+        delete integrator;
+    }
+
+    delete sys;
+}
+
+int main ( int argc, char ** argv )
+{
+        int minSize = 1000;
+        int maxSize = 1000000;
+        int reps = 5;
+        int threads = 1;
+        float dt = 0.001f;
+        const char * out = NULL;
+        const char * scenes = "both";
+
+        for(int i = 1; i < argc; ++i){
+                if(i + 1 >= argc)
+                        usage(argv[0]);
+                if(!strcmp(argv[i], "-min"))
+                        minSize = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-max"))
+                        maxSize = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-reps"))
+                        reps = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-dt"))
+                        dt = atof(argv[++i]);
+                else if(!strcmp(argv[i], "-threads"))
+                        threads = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-scene"))
+                        scenes = argv[++i];
+                else if(!strcmp(argv[i], "-out"))
+                        out = argv[++i];
+                else
+                        usage(argv[0]);
+        }
+        if(strcmp(scenes, "cloth") && strcmp(scenes, "chain") && strcmp(scenes, "both")){
+                printf("unknown scene %s\n", scenes);
+                usage(argv[0]);
+        }
+        if(reps < 1)
+                reps = 1;
+
+        FILE * csv = NULL;
+        if(out){
+                csv = fopen(out, "w");
+                if(!csv){
+                        printf("could not open %s\n", out);
+                        exit(-1);
+                }
+                fprintf(csv, "scene,particles,kernel,ns_per_call,ns_per_particle,iterations\n");
+        }
+
+        // scene sizes grow by a factor of 10 from minSize up to maxSize particles
+        for(int size = minSize; size <= maxSize; size *= 10){
+                if(strcmp(scenes, "chain"))
+                        bench_scene(csv, "cloth", size, reps, dt, threads);
+                if(strcmp(scenes, "cloth"))
+                        bench_scene(csv, "chain", size, reps, dt, threads);
+        }
+
+        if(csv)
+                fclose(csv);
+        exit ( 0 );
+}
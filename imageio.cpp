@@ -132,7 +132,8 @@ unsigned char *_loadImageRGBApng(char *fileName, int *width, int *height) {
   return buffer;
 }
 
-bool _saveImageRGBApng(char *fileName, unsigned char *buffer, int width, int height) {
+bool _saveImageRGBApng(char *fileName, unsigned char *buffer, int width, int height,
+                       const PngOptions &options) {
   // open the file
   FILE *fp = fopen(fileName, "wb");
   if (!fp)
@@ -161,16 +162,25 @@ bool _saveImageRGBApng(char *fileName, unsigned char *buffer, int width, int hei
   // set up the io
   png_init_io(png_ptr, fp);
   
+  // set up the encoder
+  if (options.compressionLevel >= 0)
+    png_set_compression_level(png_ptr, options.compressionLevel);
+  if (options.filters >= 0)
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, options.filters);
+
   // write the header
-  png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 
+  png_set_IHDR(png_ptr, info_ptr, width, height, 8,
+	       options.rgb ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, 
 	       PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
   png_write_info(png_ptr, info_ptr);
-  png_set_flush(png_ptr, 10);
+  // libpng skips the alpha bytes as it reads the rows
+  if (options.rgb)
+    png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
 
-  // write the image
+  // write the image, flipping it by the order of the row pointers
   png_bytep row_pointers[height];
   for (int y = 0 ; y < height ; y++)
-    row_pointers[y] = (png_byte *) (buffer + (height - 1 - y) * width * 4);
+    row_pointers[y] = (png_byte *) (buffer + (options.flip ? height - 1 - y : y) * width * 4);
   png_write_image(png_ptr, row_pointers);
   png_write_end(png_ptr, info_ptr);
   
@@ -199,8 +209,15 @@ unsigned char *loadImageRGBA(char *fileName, int *width, int *height) {
 // to the given file name, returns true on success, false otherwise.
 // The image format is RGBA.
 bool saveImageRGBA(char *fileName, unsigned char *buffer, int width, int height) {
+  return saveImageRGBA(fileName, buffer, width, height, PngOptions());
+}
+
+// Saves image given by buffer, which is RGBA, with the given encoder
+// settings. Returns true on success, false otherwise.
+bool saveImageRGBA(char *fileName, unsigned char *buffer, int width, int height,
+                   const PngOptions &options) {
   if (_endsWith(fileName, ".png")) {
-    return _saveImageRGBApng(fileName, buffer, width, height);
+    return _saveImageRGBApng(fileName, buffer, width, height, options);
   } else {
     return false;
   }
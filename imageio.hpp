@@ -46,6 +46,27 @@ unsigned char *loadImageRGBA(unsigned char *fileName, int *width, int *height);
 // The image format is RGBA.
 bool saveImageRGBA(char *fileName, unsigned char *buffer, int width, int height);
 
+// Settings of the png encoder. The defaults give what saveImageRGBA
+// above writes.
+struct PngOptions {
+  // zlib level from 0 (store) to 9 (smallest), -1 for zlib's default
+  int compressionLevel;
+  // the row filters libpng may choose from, as PNG_FILTER_NONE,
+  // PNG_ALL_FILTERS and so on, -1 for libpng's default choice
+  int filters;
+  // writes RGB and drops the alpha channel of the buffer
+  bool rgb;
+  // the buffer is stored bottom row first, as glReadPixels returns it
+  bool flip;
+
+  PngOptions() : compressionLevel(-1), filters(-1), rgb(false), flip(true) {}
+};
+
+// Saves image given by buffer, which is RGBA, with the given encoder
+// settings. Returns true on success, false otherwise.
+bool saveImageRGBA(char *fileName, unsigned char *buffer, int width, int height,
+                   const PngOptions &options);
+
 // returns index into image buffer for given coordinate
 #define indxRGBA(X,Y,W) (((Y) * (W) + (X)) * 4)
 
@@ -1,36 +1,48 @@
 #include "integrator.h"
 #include "System.h"
+#include <algorithm>
+#include <math.h>
 
 /**
  * Uses the basic Euler integration method, x' = x + dx/dt * dt.
  * @param sys The system to integrate
  * @param dt The time step to integrate over
  */
-void EulerIntegrator::integrate( System sys, float dt ) const
+void EulerIntegrator::integrate( System& sys, float dt ) const
 {
     int size = sys.size();
 
     if (size == 0)
         return;
-    state.resize( size );
-    deriv_state.resize( size );
 
-    // get the current state
-    sys.get_state( state );
+    // the state lives in the system's particle store
+    ParticleStore& state = sys.get_particles();
 
     // compute the current derivative
-    sys.deriv_eval( deriv_state );
+    sys.deriv_eval( deriv_position, deriv_velocity );
 
     // update the state
     for(int i = 0; i < size; ++i){
         for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += deriv_state[i]->deriv_position[j] * dt;
-            state[i]->Velocity[j] += deriv_state[i]->deriv_velocity[j] * dt;
+            state.position[i][j] += deriv_position[i][j] * dt;
+            state.velocity[i][j] += deriv_velocity[i][j] * dt;
         }
     }
+}
+
+/**
+ * Sets the system's state to x0 + k_x * h, v0 + k_v * h.
+ */
+static void set_stage_state( ParticleStore& state, const Integrator::StateList& x0,
+                             const Integrator::StateList& v0, const Integrator::StateList& k_x,
+                             const Integrator::StateList& k_v, float h )
+{
+    int size = state.size();
 
-    // set the updated state
-    sys.set_state( state );
+    for(int i = 0; i < size; ++i){
+        state.position[i] = x0[i] + k_x[i] * h;
+        state.velocity[i] = v0[i] + k_v[i] * h;
+    }
 }
 
 /**
@@ -38,52 +50,27 @@ void EulerIntegrator::integrate( System sys, float dt ) const
  * @param sys The system to integrate
  * @param dt The time step to integrate over
  */
-void RK2Integrator::integrate( System sys, float dt ) const
+void RK2Integrator::integrate( System& sys, float dt ) const
 {
     int size = sys.size();
 
     if (size == 0)
         return;
-    state.resize( size );
-    mid_deriv.resize( size );
-    deriv_state.resize( size );
 
-    // get the current state
-    sys.get_state( state );
+    // the state lives in the system's particle store
+    ParticleStore& state = sys.get_particles();
+    x0 = state.position;
+    v0 = state.velocity;
 
     // compute the current derivative
-    sys.deriv_eval( deriv_state );
-
-    // get midpoint state
-    for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += deriv_state[i]->deriv_position[j] * dt/2.f;
-            state[i]->Velocity[j] += deriv_state[i]->deriv_velocity[j] * dt/2.f;
-        }
-    }
+    sys.deriv_eval( k1_x, k1_v );
 
     // get derivative at the midpoint
-    sys.set_state( state );
-    sys.deriv_eval( mid_deriv );
-
-    // reset the state
-    for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] -= deriv_state[i]->deriv_position[j] * dt/2.f;
-            state[i]->Velocity[j] -= deriv_state[i]->deriv_velocity[j] * dt/2.f;
-        }
-    }
+    set_stage_state( state, x0, v0, k1_x, k1_v, dt/2.f );
+    sys.deriv_eval( k2_x, k2_v );
 
     // get full point state using midpoint derivative
-    for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += mid_deriv[i]->deriv_position[j] * dt;
-            state[i]->Velocity[j] += mid_deriv[i]->deriv_velocity[j] * dt;
-        }
-    }
-
-    // set the state to (pos + pos' * dt, t + dt)
-    sys.set_state( state );
+    set_stage_state( state, x0, v0, k2_x, k2_v, dt );
 }
 
 /**
@@ -91,140 +78,382 @@ void RK2Integrator::integrate( System sys, float dt ) const
  * @param sys The system to integrate
  * @param dt The time step to integrate over
  */
-void RK4Integrator::integrate( System sys, float dt ) const
+void RK4Integrator::integrate( System& sys, float dt ) const
 {
     int size = sys.size();
 
     if (size == 0)
         return;
-    state.resize( size );
-    k1.resize( size );
-    k2.resize( size );
-    k3.resize( size );
-    k4.resize( size );
-
-    // get the current state
-    sys.get_state( state );
-    sys.get_state( k1 );
-    sys.get_state( k2 );
-    sys.get_state( k3 );
-    sys.get_state( k4 );
+
+    // the state lives in the system's particle store
+    ParticleStore& state = sys.get_particles();
+    x0 = state.position;
+    v0 = state.velocity;
 
     // compute the current derivative
-    sys.deriv_eval( k1 );
+    sys.deriv_eval( k1_x, k1_v );
+
+    // get derivative at the midpoint
+    set_stage_state( state, x0, v0, k1_x, k1_v, dt/2.f );
+    sys.deriv_eval( k2_x, k2_v );
 
-    // get midpoint state
+    // get derivative at the new midpoint
+    set_stage_state( state, x0, v0, k2_x, k2_v, dt/2.f );
+    sys.deriv_eval( k3_x, k3_v );
+
+    // get derivative at the guess for the final state
+    set_stage_state( state, x0, v0, k3_x, k3_v, dt );
+    sys.deriv_eval( k4_x, k4_v );
+
+    // get final state using all 4 derivatives
     for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += k1[i]->deriv_position[j] * dt/2.f;
-            state[i]->Velocity[j] += k1[i]->deriv_velocity[j] * dt/2.f;
-        }
+        state.position[i] = x0[i] + (k1_x[i] + 2.f * (k2_x[i] + k3_x[i]) + k4_x[i]) * (dt/6.f);
+        state.velocity[i] = v0[i] + (k1_v[i] + 2.f * (k2_v[i] + k3_v[i]) + k4_v[i]) * (dt/6.f);
     }
+}
 
-    // get derivative at the midpoint
-    sys.set_state( state );
-    sys.deriv_eval( k2 );
+/**
+ * Uses a symplectic euler integration method. First the postion is
+ * calculated explicitly and the the velocity is calculated implicitly.
+ * @param sys The system to integrate
+ * @param dt The time step to integrate over
+ */
+void SymplecticEulerIntegrator::integrate( System& sys, float dt ) const
+{
+    int size = sys.size();
+
+    if (size == 0)
+        return;
 
-    // reset the state
+    // the state (pos, t) lives in the system's particle store
+    ParticleStore& state = sys.get_particles();
+
+    // compute the current derivative (pos')
+    sys.deriv_eval( deriv_position, deriv_velocity );
+
+    // update the x component explicitly.
     for(int i = 0; i < size; ++i){
         for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] -= k1[i]->deriv_position[j] * dt/2.f;
-            state[i]->Velocity[j] -= k1[i]->deriv_velocity[j] * dt/2.f;
+            //state.position[i][j] += deriv_position[i][j] * dt;
+            state.velocity[i][j] += deriv_velocity[i][j] * dt;
         }
     }
 
-    // get second midpoint state
+    // update the y component implicitly with the x component at t + dt
     for(int i = 0; i < size; ++i){
         for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += k2[i]->deriv_position[j] * dt/2.f;
-            state[i]->Velocity[j] += k2[i]->deriv_velocity[j] * dt/2.f;
+            state.position[i][j] += state.velocity[i][j] * dt;
+            //state.velocity[i][j] += deriv_velocity[i][j] * dt;
         }
     }
+}
 
-    // get derivative at the new midpoint
-    sys.set_state( state );
-    sys.deriv_eval( k3 );
+/**
+ * The matrix M - h df/dv - h^2 df/dx of the implicit step over two doubles
+ * per particle, applied through the springs' Jacobian blocks.
+ */
+class ImplicitStepMatrix : public implicitMatrix
+{
+public:
+    ImplicitStepMatrix( SpringStore* i_springs, double i_h ) : springs(i_springs), h(i_h) { }
+    virtual void matVecMult( double x[], double r[] )
+    {
+        springs->jacobian_mult(1.0, h, h*h, x, r);
+    }
+private:
+    SpringStore* springs;
+    double h;
+};
+
+/**
+ * Uses backward Euler on the spring forces.
+ * @param sys The system to integrate
+ * @param dt The time step to integrate over
+ */
+void ImplicitEulerIntegrator::integrate( System& sys, float dt ) const
+{
+    int size = sys.size();
 
-    // reset the state
+    if (size == 0)
+        return;
+
+    ParticleStore& state = sys.get_particles();
+    SpringStore& springs = sys.get_springs();
+    int n = 2 * size;
+    double h = dt;
+
+    // the total acceleration, including gravity and the constraint forces
+    sys.deriv_eval( deriv_position, deriv_velocity );
+    springs.set_jacobians();
+
+    work.resize(n);
+    work.setPool(sys.get_pool());
+    double* b = work.b;
+    double* dv = work.lambda;
+    double* kv = work.temp;
+
+    // b = h f - h^2 Kx v, where Kx = -df/dx
     for(int i = 0; i < size; ++i){
         for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] -= k2[i]->deriv_position[j] * dt/2.f;
-            state[i]->Velocity[j] -= k2[i]->deriv_velocity[j] * dt/2.f;
+            b[2*i+j] = h * deriv_velocity[i][j] / state.invMass[i];
+            work.z[2*i+j] = state.velocity[i][j];
         }
     }
+    springs.jacobian_mult(0.0, 0.0, h*h, work.z, kv);
+    for(int i = 0; i < n; ++i)
+        b[i] -= kv[i];
+
+    // start from the explicit Euler step and solve to a tolerance relative to b
+    for(int i = 0; i < size; ++i){
+        for(int j = 0; j < 2; ++j)
+            dv[2*i+j] = h * deriv_velocity[i][j];
+    }
+    double epsilon = std::max(SOLVE_TOLERANCE * vecSqrLen(n, b), EPSILON);
+    int steps = 0;
+    ImplicitStepMatrix A(&springs, h);
+    double err = ConjGrad(n, &A, dv, b, epsilon, &steps, &work);
+    // a solve that ran out of steps still applies its best dv
+    sys.record_solve("implicit", steps, err, epsilon);
 
-    // get final state using new midpoint derivative
     for(int i = 0; i < size; ++i){
         for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += k3[i]->deriv_position[j] * dt;
-            state[i]->Velocity[j] += k3[i]->deriv_velocity[j] * dt;
+            state.velocity[i][j] += dv[2*i+j];
+            state.position[i][j] += state.velocity[i][j] * dt;
         }
     }
+}
 
-    // get derivative at the guess for the final state
-    sys.set_state( state );
-    sys.deriv_eval( k4 );
+/**
+ * Uses the velocity Verlet method.
+ * @param sys The system to integrate
+ * @param dt The time step to integrate over
+ */
+void VelocityVerletIntegrator::integrate( System& sys, float dt ) const
+{
+    int size = sys.size();
+
+    if (size == 0)
+        return;
+
+    ParticleStore& state = sys.get_particles();
+
+    // reuse the last acceleration if nothing has touched the state since
+    if (!cached || cachedVersion != state.version)
+        sys.deriv_eval( deriv_position, deriv_velocity );
 
-    // reset the state
+    // half kick and drift
     for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] -= k3[i]->deriv_position[j] * dt;
-            state[i]->Velocity[j] -= k3[i]->deriv_velocity[j] * dt;
-        }
+        state.velocity[i] += deriv_velocity[i] * (dt/2.f);
+        state.position[i] += state.velocity[i] * dt;
     }
 
-    // get final state using all 4 derivatives
+    // the other half kick with the acceleration at the new position
+    sys.deriv_eval( deriv_position, deriv_velocity );
     for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += k1[i]->deriv_position[j] * dt/6.f + k2[i]->deriv_position[j] * dt/3.f
-                                   + k3[i]->deriv_position[j] * dt/3.f + k4[i]->deriv_position[j] * dt/6.f;
-            state[i]->Velocity[j] += k1[i]->deriv_velocity[j] * dt/6.f + k2[i]->deriv_velocity[j] * dt/3.f
-                                   + k3[i]->deriv_velocity[j] * dt/3.f + k4[i]->deriv_velocity[j] * dt/6.f;
-        }
+        state.velocity[i] += deriv_velocity[i] * (dt/2.f);
     }
 
-    // set the state to (pos + pos' * dt, t + dt)
-    sys.set_state( state );
+    cached = true;
+    cachedVersion = state.version;
 }
 
 /**
- * Uses a symplectic euler integration method. First the postion is
- * calculated explicitly and the the velocity is calculated implicitly.
+ * Uses the leapfrog method.
  * @param sys The system to integrate
  * @param dt The time step to integrate over
  */
-void SymplecticEulerIntegrator::integrate( System sys, float dt ) const
+void LeapfrogIntegrator::integrate( System& sys, float dt ) const
 {
     int size = sys.size();
 
     if (size == 0)
         return;
-    state.resize(size);
-    deriv_state.resize(size);
 
-    // get the current state (pos, t)
-    sys.get_state( state );
+    ParticleStore& state = sys.get_particles();
 
-    // compute the current derivative (pos')
-    sys.deriv_eval( deriv_state );
+    // drift to the midpoint
+    for(int i = 0; i < size; ++i){
+        state.position[i] += state.velocity[i] * (dt/2.f);
+    }
 
-    // update the x component explicitly.
+    // kick with the acceleration there, then drift the rest of the way
+    sys.deriv_eval( deriv_position, deriv_velocity );
     for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            //state[i]->Position[j] += deriv_state[i]->deriv_position[j] * dt;
-            state[i]->Velocity[j] += deriv_state[i]->deriv_velocity[j] * dt;
+        state.velocity[i] += deriv_velocity[i] * dt;
+        state.position[i] += state.velocity[i] * (dt/2.f);
+    }
+}
+
+// the Dormand-Prince tableau
+static const double DP_A[7][6] = {
+    { 0 },
+    { 1.0/5 },
+    { 3.0/40, 9.0/40 },
+    { 44.0/45, -56.0/15, 32.0/9 },
+    { 19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729 },
+    { 9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656 },
+    { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84 }
+};
+// the fifth order weights are the last row of DP_A; these are the fifth
+// order minus the fourth order weights, which estimate the error
+static const double DP_E[7] = {
+    71.0/57600, 0, -71.0/16695, 71.0/1920, -17253.0/339200, 22.0/525, -1.0/40
+};
+
+// bounds on how much one substep may change the size of the next
+#define ADAPTIVE_SAFETY 0.9
+#define ADAPTIVE_MIN_SCALE 0.2
+#define ADAPTIVE_MAX_SCALE 5.0
+// substeps this small are accepted whatever their error, so that a
+// singular moment cannot stall the simulation
+#define ADAPTIVE_MIN_STEP 1.0e-7
+
+AdaptiveRK45Integrator::AdaptiveRK45Integrator( double i_atol, double i_rtol ) :
+    atol(i_atol), rtol(i_rtol), h(0), accepted(0), rejected(0),
+    cached(false), cachedVersion(0)
+{
+}
+
+double AdaptiveRK45Integrator::attempt( System& sys, double step, bool haveK1 ) const
+{
+    ParticleStore& state = sys.get_particles();
+    int size = state.size();
+
+    // k1 is the derivative at x0, the rest at the stages built from it
+    if (!haveK1)
+        sys.deriv_eval( k_x[0], k_v[0] );
+    for(int s = 1; s < 7; ++s){
+        for(int i = 0; i < size; ++i){
+            Vec2 x = x0[i], v = v0[i];
+            for(int j = 0; j < s; ++j){
+                x += Vec2(k_x[j][i]) * (step * DP_A[s][j]);
+                v += Vec2(k_v[j][i]) * (step * DP_A[s][j]);
+            }
+            state.position[i] = x;
+            state.velocity[i] = v;
         }
+        sys.deriv_eval( k_x[s], k_v[s] );
     }
 
-    // update the y component implicitly with the x component at t + dt
+    // the system now holds the fifth order result, compare it to the fourth.
+    // A NaN, which std::max would drop, is kept so that the substep is
+    // rejected, and nothing after it may replace it.
+    double err = 0;
     for(int i = 0; i < size; ++i){
-        for(int j = 0; j < 2; ++j){
-            state[i]->Position[j] += state[i]->Velocity[j] * dt;
-            //state[i]->Velocity[j] += deriv_state[i]->deriv_velocity[j] * dt;
+        Vec2 ex(0.0, 0.0), ev(0.0, 0.0);
+        for(int j = 0; j < 7; ++j){
+            ex += Vec2(k_x[j][i]) * DP_E[j];
+            ev += Vec2(k_v[j][i]) * DP_E[j];
+        }
+        for(int c = 0; c < 2; ++c){
+            double sx = atol + rtol * std::max(fabs(x0[i][c]), fabs(state.position[i][c]));
+            double sv = atol + rtol * std::max(fabs(v0[i][c]), fabs(state.velocity[i][c]));
+            double e = fabs(step * ex[c]) / sx;
+            if (isnan(e) || e > err)
+                err = e;
+            e = fabs(step * ev[c]) / sv;
+            if (isnan(e) || e > err)
+                err = e;
+        }
+    }
+    return err;
+}
+
+/**
+ * Uses the adaptive Dormand-Prince method.
+ * @param sys The system to integrate
+ * @param dt The time step to integrate over
+ */
+void AdaptiveRK45Integrator::integrate( System& sys, float dt ) const
+{
+    if (sys.size() == 0)
+        return;
+
+    ParticleStore& state = sys.get_particles();
+    if (h <= 0 || h > dt)
+        h = dt;
+
+    // the last stage of the last step is still good if nothing has moved
+    // the particles since
+    bool haveK1 = cached && cachedVersion == state.version;
+
+    double t = 0;
+    while (t < dt) {
+        double step = std::min(h, dt - t);
+        bool clipped = step < h;
+
+        x0 = state.position;
+        v0 = state.velocity;
+        double err = attempt( sys, step, haveK1 );
+
+        // a substep that overflowed is rejected and shrunk as far as it may be
+        bool finite = isfinite(err);
+        bool accept = (finite && err <= 1.0) || step <= ADAPTIVE_MIN_STEP;
+        if (accept) {
+            // one that still overflows at the smallest substep cannot be
+            // saved, so the rest of the time step is given up rather than
+            // ground through ADAPTIVE_MIN_STEP at a time
+            t = finite ? t + step : dt;
+            ++accepted;
+            // first same as last: k7 is the derivative at the new x0
+            std::swap(k_x[0], k_x[6]);
+            std::swap(k_v[0], k_v[6]);
+        } else {
+            // x0 is put back, so k1 still holds for the smaller substep
+            state.position = x0;
+            state.velocity = v0;
+            ++rejected;
         }
+        haveK1 = true;
+
+        double scale = ADAPTIVE_MAX_SCALE;
+        if (!finite)
+            scale = ADAPTIVE_MIN_SCALE;
+        else if (err > 0)
+            scale = std::min(ADAPTIVE_MAX_SCALE,
+                             std::max(ADAPTIVE_MIN_SCALE, ADAPTIVE_SAFETY * pow(err, -0.2)));
+        // a substep cut short by the end of the time step says little about h
+        if (accept && clipped)
+            h = std::max(h, step * scale);
+        else
+            h = std::max(step * scale, ADAPTIVE_MIN_STEP);
     }
+    // no substep can be longer than a time step
+    h = std::min(h, (double)dt);
 
-    // set the state to (pos + pos' * dt, t + dt)
-    sys.set_state( state );
+    cached = true;
+    cachedVersion = state.version;
 }
 
+Integrator* create_integrator( char key )
+{
+    switch ( key )
+    {
+    case '1':
+        return new EulerIntegrator();
+
+    case '2':
+        return new RK2Integrator();
+
+    case '3':
+        return new SymplecticEulerIntegrator();
+
+    case '4':
+        return new RK4Integrator();
+
+    case '5':
+        return new ImplicitEulerIntegrator();
+
+    case '6':
+        return new AdaptiveRK45Integrator();
+
+    case '7':
+        return new VelocityVerletIntegrator();
+
+    case '8':
+        return new LeapfrogIntegrator();
+
+    default:
+        return new RK4Integrator();
+    }
+}
@@ -18,11 +18,25 @@ public:
      *   from the system's current step.
      * @param dt The length of the time step to integrate.
      */
-    virtual void integrate( System sys, float dt ) const = 0;
+    virtual void integrate( System& sys, float dt ) const = 0;
+
+    /**
+     * Integrate one time step and then let the system enforce its
+     * constraints, which it does when they are projected with XPBD.
+     * This is what the simulation loops call.
+     * @param sys The system to step.
+     * @param dt The length of the time step.
+     */
+    void step( System& sys, float dt ) const
+    {
+        sys.begin_step();
+        integrate( sys, dt );
+        sys.end_step( dt );
+    }
 
     // used for storing state vectors locally
     // without allocating memory every time.
-    typedef std::vector<Particle*> StateList;
+    typedef std::vector<Vec2f> StateList;
 };
 
 /**
@@ -33,10 +47,10 @@ class EulerIntegrator : public Integrator
 public:
     EulerIntegrator() { }
     virtual ~EulerIntegrator() { }
-    virtual void integrate( System sys, float dt ) const;
+    virtual void integrate( System& sys, float dt ) const;
 private:
-    mutable StateList state;
-    mutable StateList deriv_state;
+    mutable StateList deriv_position;
+    mutable StateList deriv_velocity;
 };
 
 /**
@@ -47,11 +61,16 @@ class RK2Integrator : public Integrator
 public:
     RK2Integrator() { }
     virtual ~RK2Integrator() { }
-        virtual void integrate( System sys, float dt ) const;
+        virtual void integrate( System& sys, float dt ) const;
 private:
-        mutable StateList state;
-        mutable StateList mid_deriv;
-        mutable StateList deriv_state;
+        // the state at the start of the step
+        mutable StateList x0;
+        mutable StateList v0;
+        // the derivatives at the start and at the midpoint
+        mutable StateList k1_x;
+        mutable StateList k1_v;
+        mutable StateList k2_x;
+        mutable StateList k2_v;
 };
 
 /**
@@ -62,14 +81,20 @@ class RK4Integrator : public Integrator
 public:
     RK4Integrator() { }
     virtual ~RK4Integrator() { }
-    virtual void integrate( System sys, float dt ) const;
+    virtual void integrate( System& sys, float dt ) const;
 private:
-    mutable StateList state;
+    // the state at the start of the step
+    mutable StateList x0;
+    mutable StateList v0;
     // the derivatives at each guess
-    mutable StateList k1;
-    mutable StateList k2;
-    mutable StateList k3;
-    mutable StateList k4;
+    mutable StateList k1_x;
+    mutable StateList k1_v;
+    mutable StateList k2_x;
+    mutable StateList k2_v;
+    mutable StateList k3_x;
+    mutable StateList k3_v;
+    mutable StateList k4_x;
+    mutable StateList k4_v;
 };
 
 /**
@@ -81,9 +106,119 @@ class SymplecticEulerIntegrator : public Integrator
 public:
     SymplecticEulerIntegrator() { }
     virtual ~SymplecticEulerIntegrator() { }
-    virtual void integrate( System sys, float dt ) const;
+    virtual void integrate( System& sys, float dt ) const;
+private:
+    mutable StateList deriv_position;
+    mutable StateList deriv_velocity;
+};
+
+/**
+ * Uses backward Euler on the spring forces in the style of Baraff and
+ * Witkin, solving (M - dt df/dv - dt^2 df/dx) dv = dt (f + dt df/dx v)
+ * with conjugate gradients over the spring Jacobians. Gravity and the
+ * constraint forces are taken explicitly from deriv_eval, so large steps
+ * are limited by the constraints rather than by stiff springs.
+ */
+class ImplicitEulerIntegrator : public Integrator
+{
+public:
+    ImplicitEulerIntegrator() { }
+    virtual ~ImplicitEulerIntegrator() { }
+    virtual void integrate( System& sys, float dt ) const;
 private:
-	mutable StateList state;
-	mutable StateList deriv_state;
+    mutable StateList deriv_position;
+    mutable StateList deriv_velocity;
+    // holds the right hand side in b and the change in velocity in lambda
+    mutable SolverWorkspace work;
 };
 
+/**
+ * Uses the embedded 5(4) Runge-Kutta pair of Dormand and Prince, taking
+ * as many substeps as it needs to cover each time step. The size of the
+ * substeps is adjusted to keep the estimated local error of every
+ * position and velocity component below atol + rtol * |component|, and
+ * carries over from one time step to the next.
+ */
+class AdaptiveRK45Integrator : public Integrator
+{
+public:
+    AdaptiveRK45Integrator( double i_atol = 1.0e-5, double i_rtol = 1.0e-5 );
+    virtual ~AdaptiveRK45Integrator() { }
+    virtual void integrate( System& sys, float dt ) const;
+
+    // the number of substeps accepted and rejected so far
+    int accepted_steps() const { return accepted; }
+    int rejected_steps() const { return rejected; }
+    // the size of the next substep, which is at most the last time step
+    double step_size() const { return h; }
+private:
+    // tries a substep of size step from x0, v0 and returns the error
+    // relative to the tolerance, leaving the fifth order result in the
+    // system. The first stage is only evaluated when haveK1 is false.
+    double attempt( System& sys, double step, bool haveK1 ) const;
+
+    double atol;
+    double rtol;
+    mutable double h;
+    mutable int accepted;
+    mutable int rejected;
+    // the state at the start of the substep
+    mutable StateList x0;
+    mutable StateList v0;
+    // the derivatives at each stage. The last stage is evaluated at the
+    // fifth order result, so after an accepted substep it is the first
+    // stage of the next one, and it carries over to the next time step
+    // while the particles' version is still cachedVersion.
+    mutable StateList k_x[7];
+    mutable StateList k_v[7];
+    mutable bool cached;
+    mutable unsigned long cachedVersion;
+};
+
+/**
+ * Uses the velocity Verlet method: a half kick of the velocity, a drift of
+ * the position and another half kick with the new acceleration. That
+ * acceleration is kept for the first half kick of the next step, so a
+ * step costs one deriv_eval as long as nothing else moves the particles
+ * in between (XPBD projection, the mouse, a reset), which is told by the
+ * particles' version.
+ */
+class VelocityVerletIntegrator : public Integrator
+{
+public:
+    VelocityVerletIntegrator() : cached(false), cachedVersion(0) { }
+    virtual ~VelocityVerletIntegrator() { }
+    virtual void integrate( System& sys, float dt ) const;
+private:
+    mutable StateList deriv_position;
+    mutable StateList deriv_velocity;
+    // whether deriv_velocity can be reused, and the particles' version when
+    // it was kept. It was evaluated at the last step's final positions and
+    // at the velocities before the second half kick, so it stands in for
+    // the acceleration at the post-kick velocities the step left.
+    mutable bool cached;
+    mutable unsigned long cachedVersion;
+};
+
+/**
+ * Uses the leapfrog method in drift-kick-drift form: half a step of
+ * position, a full step of velocity with the acceleration at the
+ * midpoint, and the other half step of position. One deriv_eval per step.
+ */
+class LeapfrogIntegrator : public Integrator
+{
+public:
+    LeapfrogIntegrator() { }
+    virtual ~LeapfrogIntegrator() { }
+    virtual void integrate( System& sys, float dt ) const;
+private:
+    mutable StateList deriv_position;
+    mutable StateList deriv_velocity;
+};
+
+/**
+ * Creates the integrator selected by a command line key:
+ * 1-euler, 2-RK2, 3-sympleticEuler, 4-RK4, 5-implicit Euler,
+ * 6-adaptive RK45, 7-velocity Verlet, 8-leapfrog. Other keys give RK4.
+ */
+Integrator* create_integrator( char key );
@@ -1,83 +1,385 @@
 #include "linearSolver.h"
+#include "SimStats.h"
+#include <algorithm>
+#include <float.h>
 
-implicitMatrixImpl::implicitMatrixImpl(std::vector<CircularWireConstraint*> i_wireConstVector,
-        std::vector<RodConstraint*> i_rodConstVector) : wireConstVector(i_wireConstVector),
-        rodConstVector(i_rodConstVector){ }
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+implicitMatrixImpl::implicitMatrixImpl() : transposed(false), pool(NULL){ }
 
 implicitMatrixImpl::~implicitMatrixImpl(){ }
 
-/**
- * Assumes that constraints are numbered so that wire constaints are lower numbers
- * and that they are numbered in the order of the respective vectors (wireConstVector and rodConstVector.
- **/
-void implicitMatrixImpl::matVecMult(double x[], double r[]){
+void implicitMatrixImpl::assemble(const std::vector<CircularWireConstraint*> & wireConstVector,
+        const std::vector<RodConstraint*> & rodConstVector, const ParticleStore & particles){
     int num_wC = wireConstVector.size();
     int num_rC = rodConstVector.size();
-    int num_const = num_wC + num_rC;
+
+    rowStart.clear();
+    blockCol.clear();
+    blocks.clear();
+    colParticle.clear();
+    colInvMass.clear();
+    colOf.resize(particles.size(), -1);
+
+    rowStart.push_back(0);
+    for(int i = 0; i < num_wC; ++i){
+        addBlock(wireConstVector[i]->get_id(), wireConstVector[i]->get_J(), particles);
+        rowStart.push_back(blocks.size());
+    }
+    for(int i = 0; i < num_rC; ++i){
+        // dC/dx2 = -dC/dx1
+        Vec2 J = rodConstVector[i]->get_J();
+        addBlock(rodConstVector[i]->get_id1(), J, particles);
+        addBlock(rodConstVector[i]->get_id2(), -J, particles);
+        rowStart.push_back(blocks.size());
+    }
+
+    // leave the column map clean for the next assembly
+    for(int c = 0; c < colParticle.size(); ++c)
+        colOf[colParticle[c]] = -1;
+    scratch.resize(colParticle.size());
+
+    transposed = false;
+    if(pool)
+        transpose();
+}
+
+void implicitMatrixImpl::setPool(ThreadPool *i_pool){
+    pool = i_pool;
+}
+
+void implicitMatrixImpl::addBlock(int particle, const Vec2 & block, const ParticleStore & particles){
+    if(colOf[particle] < 0){
+        colOf[particle] = colParticle.size();
+        colParticle.push_back(particle);
+        colInvMass.push_back(particles.invMass[particle]);
+    }
+    blockCol.push_back(colOf[particle]);
+    blocks.push_back(block);
+}
+
+int implicitMatrixImpl::rows(){
+    return rowStart.size() - 1;
+}
+
+// runs one half of implicitMatrixImpl::matVecMult over a range
+class matrixRangeTask : public ParallelTask
+{
+public:
+    typedef void (implicitMatrixImpl::*Range)(double x[], double r[], int begin, int end);
+    matrixRangeTask(implicitMatrixImpl *i_A, Range i_range, double i_x[], double i_r[]) :
+        A(i_A), range(i_range), x(i_x), r(i_r) { }
+    virtual void run(int begin, int end, int thread) { (A->*range)(x, r, begin, end); }
+private:
+    implicitMatrixImpl *A;
+    Range range;
+    double *x;
+    double *r;
+};
+
+void implicitMatrixImpl::matVecMult(double x[], double r[]){
+    int num_const = rows();
+    int num_cols = colParticle.size();
+
+    if(pool){
+        matVecMultThreaded(x, r);
+        return;
+    }
+
+    // scratch = W J^T x
+    for(int c = 0; c < num_cols; ++c)
+        scratch[c] = Vec2(0.0, 0.0);
+    for(int i = 0; i < num_const; ++i){
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k)
+            scratch[blockCol[k]] += blocks[k] * x[i];
+    }
+    for(int c = 0; c < num_cols; ++c)
+        scratch[c] *= colInvMass[c];
+
+    // r = J scratch
+    for(int i = 0; i < num_const; ++i){
+        r[i] = 0;
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k)
+            r[i] += blocks[k] * scratch[blockCol[k]];
+    }
+}
+
+void implicitMatrixImpl::matVecMultThreaded(double x[], double r[]){
+    // with J transposed every column and every row is written by one
+    // thread only, and sums in the same order as the serial version
+    if(!transposed)
+        transpose();
+    matrixRangeTask wjt(this, &implicitMatrixImpl::wjtMultColumns, x, r);
+    matrixRangeTask j(this, &implicitMatrixImpl::jMultRows, x, r);
+    pool->parallel_for(colParticle.size(), &wjt);
+    pool->parallel_for(rows(), &j);
+}
+
+void implicitMatrixImpl::wjtMultColumns(double x[], double r[], int begin, int end){
+    for(int c = begin; c < end; ++c){
+        Vec2 sum(0.0, 0.0);
+        for(int m = colStart[c]; m < colStart[c+1]; ++m){
+            int k = colBlocks[m];
+            sum += blocks[k] * x[blockRow[k]];
+        }
+        scratch[c] = sum * colInvMass[c];
+    }
+}
+
+void implicitMatrixImpl::jMultRows(double x[], double r[], int begin, int end){
+    for(int i = begin; i < end; ++i){
+        r[i] = 0;
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k)
+            r[i] += blocks[k] * scratch[blockCol[k]];
+    }
+}
+
+void implicitMatrixImpl::jwMult(const std::vector<Vec2f> & q, double r[]){
+    int num_const = rows();
 
     for(int i = 0; i < num_const; ++i){
         r[i] = 0;
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k){
+            int c = blockCol[k];
+            r[i] += blocks[k] * Vec2(q[colParticle[c]]) * colInvMass[c];
+        }
+    }
+}
+
+void implicitMatrixImpl::jtMultAdd(double x[], std::vector<Vec2f> & q){
+    int num_const = rows();
+
+    for(int i = 0; i < num_const; ++i){
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k)
+            q[colParticle[blockCol[k]]] += blocks[k] * x[i];
+    }
+}
+
+void implicitMatrixImpl::diagonal(double d[]){
+    int num_const = rows();
+
+    for(int i = 0; i < num_const; ++i){
+        d[i] = 0;
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k)
+            d[i] += blocks[k] * blocks[k] * colInvMass[blockCol[k]];
+    }
+}
+
+void implicitMatrixImpl::transpose(){
+    int num_const = rows();
+    int num_cols = colParticle.size();
+    int num_blocks = blocks.size();
+
+    blockRow.resize(num_blocks);
+    for(int i = 0; i < num_const; ++i){
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k)
+            blockRow[k] = i;
+    }
+    colStart.assign(num_cols + 1, 0);
+    for(int k = 0; k < num_blocks; ++k)
+        colStart[blockCol[k]]++;
+    int sum = 0;
+    for(int c = 0; c < num_cols; ++c){
+        int count = colStart[c];
+        colStart[c] = sum;
+        sum += count;
+    }
+    colStart[num_cols] = sum;
+    // blocks are visited in row order, so each column lists its rows in order
+    colBlocks.resize(num_blocks);
+    for(int k = 0; k < num_blocks; ++k)
+        colBlocks[colStart[blockCol[k]]++] = k;
+    for(int c = num_cols; c > 0; --c)
+        colStart[c] = colStart[c-1];
+    colStart[0] = 0;
+    transposed = true;
+}
+
+void implicitMatrixImpl::lowerTriangle(std::vector<int> & o_rowStart, std::vector<int> & o_cols,
+        std::vector<double> & o_vals){
+    int num_const = rows();
+
+    // transpose J so that the constraints sharing a particle can be found
+    if(!transposed)
+        transpose();
 
-        // adds constraint information for a wire constraint
-        if(i < num_wC){
-            // diagnal term
-            r[i] += wireConstVector[i]->get_J() * wireConstVector[i]->get_J() * x[i]
-                    / wireConstVector[i]->get_mass();
-
-            // adds constraint information for particles with both a rod and wire constraint
-            for(int k = 0; k < rodConstVector.size(); ++k){
-                if(wireConstVector[i]->get_id() == rodConstVector[k]->get_id1()){
-                    r[i] += wireConstVector[i]->get_J()*rodConstVector[k]->get_J() * x[k]
-                            / wireConstVector[i]->get_mass();
-                    // by symetry, can add this now
-                    r[k] += wireConstVector[i]->get_J()*rodConstVector[k]->get_J() * x[i]
-                            / wireConstVector[i]->get_mass();
-                } else{
-                    if(wireConstVector[i]->get_id() == rodConstVector[k]->get_id2()){
-                        r[i] -= wireConstVector[i]->get_J()*rodConstVector[k]->get_J() * x[k]
-                                / wireConstVector[i]->get_mass();
-                        // by symetry, can add this now
-                        r[k] -= wireConstVector[i]->get_J()*rodConstVector[k]->get_J() * x[i]
-                                / wireConstVector[i]->get_mass();
-                    }
+    // row i of J W J^T has an entry for every constraint j sharing a particle with i
+    rowAcc.resize(num_const);
+    rowMark.assign(num_const, -1);
+    o_rowStart.clear();
+    o_cols.clear();
+    o_vals.clear();
+    o_rowStart.push_back(0);
+    for(int i = 0; i < num_const; ++i){
+        int start = o_cols.size();
+        for(int k = rowStart[i]; k < rowStart[i+1]; ++k){
+            int c = blockCol[k];
+            for(int m = colStart[c]; m < colStart[c+1]; ++m){
+                int kk = colBlocks[m];
+                int j = blockRow[kk];
+                if(j > i)
+                    break;
+                if(rowMark[j] != i){
+                    rowMark[j] = i;
+                    rowAcc[j] = 0;
+                    o_cols.push_back(j);
                 }
+                rowAcc[j] += blocks[k] * blocks[kk] * colInvMass[c];
             }
+        }
+        std::sort(o_cols.begin() + start, o_cols.end());
+        for(int p = start; p < o_cols.size(); ++p)
+            o_vals.push_back(rowAcc[o_cols[p]]);
+        o_rowStart.push_back(o_cols.size());
+    }
+}
 
-        // adds constraint information for a rod constraint.
-        //(rod-wire constraints will have already been added)
-        }else{
-            // diagonal term
-            r[i] += rodConstVector[i - num_wC]->get_J() * rodConstVector[i - num_wC]->get_J() * x[i]
-                    * (1.f / rodConstVector[i - num_wC]->get_mass1() + 1.f / rodConstVector[i - num_wC]->get_mass2());
-
-            // add information about particles with two rod constraints
-            for(int k = 0; k < rodConstVector.size(); ++k){
-                if(k != i - num_wC){
-                    if(rodConstVector[i - num_wC]->get_id1() == rodConstVector[k]->get_id1()){
-                        r[i] += rodConstVector[i - num_wC]->get_J() * rodConstVector[k]->get_J() * x[i]
-                                / rodConstVector[i - num_wC]->get_mass1();
-                    } else{
-                        if(rodConstVector[i - num_wC]->get_id2() == rodConstVector[k]->get_id2()){
-                            r[i] += rodConstVector[i - num_wC]->get_J() * rodConstVector[k]->get_J() * x[i]
-                                    / rodConstVector[i - num_wC]->get_mass2();
-                        } else{
-                            if(rodConstVector[i - num_wC]->get_id1() == rodConstVector[k]->get_id2()){
-                                r[i] -= rodConstVector[i - num_wC]->get_J() * rodConstVector[k]->get_J() * x[i]
-                                        / rodConstVector[i - num_wC]->get_mass1();
-                            } else{
-                                if(rodConstVector[i - num_wC]->get_id2() == rodConstVector[k]->get_id1()){
-                                    r[i] -= rodConstVector[i - num_wC]->get_J() * rodConstVector[k]->get_J() * x[i]
-                                            / rodConstVector[i - num_wC]->get_mass2();
-                                }
-                            }
-                        }
-                    }
-                }
+// preconditioners
+
+jacobiPreconditioner::jacobiPreconditioner(){ }
+
+jacobiPreconditioner::~jacobiPreconditioner(){ }
+
+void jacobiPreconditioner::setup(implicitMatrixImpl *A){
+    int n = A->rows();
+
+    invDiag.resize(n);
+    if(n == 0)
+        return;
+    A->diagonal(&invDiag[0]);
+    for(int i = 0; i < n; ++i)
+        invDiag[i] = invDiag[i] > 0 ? 1.0 / invDiag[i] : 1.0;
+}
+
+void jacobiPreconditioner::apply(double r[], double z[]){
+    int n = invDiag.size();
+
+    for(int i = 0; i < n; ++i)
+        z[i] = r[i] * invDiag[i];
+}
+
+icholPreconditioner::icholPreconditioner(){ }
+
+icholPreconditioner::~icholPreconditioner(){ }
+
+void icholPreconditioner::setup(implicitMatrixImpl *A){
+    int n = A->rows();
+
+    A->lowerTriangle(rowStart, cols, vals);
+
+    // factor in place, row by row. The entries of each row are in column
+    // order, so the entries left of p are the already computed L_im, m < j.
+    for(int i = 0; i < n; ++i){
+        for(int p = rowStart[i]; p < rowStart[i+1]; ++p){
+            int j = cols[p];
+            int diag_j = rowStart[j+1] - 1;
+
+            // sum of L_im * L_jm for m < j
+            double dot = 0;
+            int pi = rowStart[i];
+            int pj = rowStart[j];
+            while(pi < p && pj < diag_j){
+                if(cols[pi] == cols[pj])
+                    dot += vals[pi++] * vals[pj++];
+                else if(cols[pi] < cols[pj])
+                    ++pi;
+                else
+                    ++pj;
+            }
+
+            if(j < i){
+                vals[p] = (vals[p] - dot) / vals[diag_j];
+            } else{
+                // keep the factor positive definite if the incomplete
+                // factorization breaks down
+                double a_ii = vals[p];
+                double l_ii = a_ii - dot;
+                if(l_ii > ICHOL_MIN_PIVOT * a_ii)
+                    vals[p] = sqrt(l_ii);
+                else
+                    vals[p] = a_ii > 0 ? sqrt(a_ii) : 1.0;
             }
         }
     }
 }
 
+void icholPreconditioner::apply(double r[], double z[]){
+    int n = rowStart.size() - 1;
+
+    // solve L y = r
+    for(int i = 0; i < n; ++i){
+        double sum = r[i];
+        int diag_i = rowStart[i+1] - 1;
+        for(int p = rowStart[i]; p < diag_i; ++p)
+            sum -= vals[p] * z[cols[p]];
+        z[i] = sum / vals[diag_i];
+    }
+
+    // solve L^T z = y
+    for(int i = n - 1; i >= 0; --i){
+        int diag_i = rowStart[i+1] - 1;
+        z[i] /= vals[diag_i];
+        for(int p = rowStart[i]; p < diag_i; ++p)
+            z[cols[p]] -= vals[p] * z[i];
+    }
+}
+
+preconditioner *createPreconditioner(PreconditionerType type){
+    switch(type){
+    case PRECOND_JACOBI:
+        return new jacobiPreconditioner();
+    case PRECOND_ICHOL:
+        return new icholPreconditioner();
+    default:
+        return NULL;
+    }
+}
+
+SolverWorkspace::SolverWorkspace(PreconditionerType precondType) :
+        precond(createPreconditioner(precondType)), lambda(NULL), b(NULL), r(NULL),
+        d(NULL), t(NULL), temp(NULL), z(NULL), best(NULL), pool(NULL), n(0), capacity(0){ }
+
+SolverWorkspace::~SolverWorkspace(){
+    delete precond;
+    free(lambda);
+    free(b);
+    free(r);
+    free(d);
+    free(t);
+    free(temp);
+    free(z);
+    free(best);
+}
+
+void SolverWorkspace::resize(int i_n){
+    n = i_n;
+    if(n <= capacity)
+        return;
+
+    capacity = n;
+    profile_count_allocation();
+    lambda = (double *) realloc(lambda, sizeof(double) * capacity);
+    b = (double *) realloc(b, sizeof(double) * capacity);
+    r = (double *) realloc(r, sizeof(double) * capacity);
+    d = (double *) realloc(d, sizeof(double) * capacity);
+    t = (double *) realloc(t, sizeof(double) * capacity);
+    temp = (double *) realloc(temp, sizeof(double) * capacity);
+    z = (double *) realloc(z, sizeof(double) * capacity);
+    best = (double *) realloc(best, sizeof(double) * capacity);
+    partial.resize(capacity / VEC_BLOCK + 1);
+}
+
+int SolverWorkspace::size(){
+    return n;
+}
+
+void SolverWorkspace::setPool(ThreadPool *i_pool){
+    pool = i_pool;
+    JWJ_t.setPool(pool);
+}
+
 // vector helper functions
 
 void vecAddEqual(int n, double r[], double v[])
@@ -117,27 +419,182 @@ double vecSqrLen(int n, double v[])
   return vecDot(n, v, v);
 }
 
+void vecAxpy(int n, double r[], double a, double v[])
+{
+  for (int i = 0; i < n; i++)
+    r[i] += a * v[i];
+}
+
+void vecXpay(int n, double d[], double beta, double z[])
+{
+  for (int i = 0; i < n; i++)
+    d[i] = z[i] + beta * d[i];
+}
+
+// the dot product of one block, summing even and odd entries separately
+// so that it takes two at a time with SSE2 and gives the same result without
+static double blockDot(int n, const double v1[], const double v2[])
+{
+  int i = 0;
+  double even = 0, odd = 0;
+#ifdef __SSE2__
+  __m128d acc = _mm_setzero_pd();
+  for (; i + 2 <= n; i += 2)
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(v1 + i), _mm_loadu_pd(v2 + i)));
+  double lanes[2];
+  _mm_storeu_pd(lanes, acc);
+  even = lanes[0];
+  odd = lanes[1];
+#else
+  for (; i + 2 <= n; i += 2) {
+    even += v1[i] * v2[i];
+    odd += v1[i+1] * v2[i+1];
+  }
+#endif
+  if (i < n)
+    even += v1[i] * v2[i];
+  return even + odd;
+}
+
+// Runs one of the blocked vector kernels over blocks [begin, end) of
+// VEC_BLOCK entries. Reductions leave one sum per block in partial.
+enum vecOp { VEC_DOT, VEC_ASSIGN, VEC_AXPY, VEC_XPAY, VEC_AXPY_SQRLEN };
+
+class vecBlockTask : public ParallelTask
+{
+public:
+  vecBlockTask(vecOp i_op, int i_n, double *i_x, double i_a, double *i_y, double *i_partial) :
+    op(i_op), n(i_n), x(i_x), a(i_a), y(i_y), partial(i_partial) { }
+
+  virtual void run(int begin, int end, int thread)
+  {
+    for (int blk = begin; blk < end; blk++) {
+      int i0 = blk * VEC_BLOCK;
+      int m = std::min(VEC_BLOCK, n - i0);
+      switch (op) {
+      case VEC_DOT:
+        partial[blk] = blockDot(m, x + i0, y + i0);
+        break;
+      case VEC_ASSIGN:
+        vecAssign(m, x + i0, y + i0);
+        break;
+      case VEC_AXPY:
+        vecAxpy(m, x + i0, a, y + i0);
+        break;
+      case VEC_XPAY:
+        vecXpay(m, x + i0, a, y + i0);
+        break;
+      case VEC_AXPY_SQRLEN:
+        // the block is still in cache when its length is taken
+        vecAxpy(m, x + i0, a, y + i0);
+        partial[blk] = blockDot(m, x + i0, x + i0);
+        break;
+      }
+    }
+  }
+
+private:
+  vecOp op;
+  int n;
+  double *x;
+  double a;
+  double *y;
+  double *partial;
+};
+
+// a thread runs at least this many blocks, below which the split costs more than it saves
+#define VEC_MIN_BLOCKS 8
+
+static double vecBlocked(vecOp op, int n, double x[], double a, double y[], double partial[],
+                         ThreadPool *pool)
+{
+  int numBlocks = (n + VEC_BLOCK - 1) / VEC_BLOCK;
+  vecBlockTask task(op, n, x, a, y, partial);
+
+  if (pool)
+    pool->parallel_for(numBlocks, &task, VEC_MIN_BLOCKS);
+  else
+    task.run(0, numBlocks, 0);
+
+  // the block sums are added in order whatever thread computed them
+  double sum = 0;
+  if (op == VEC_DOT || op == VEC_AXPY_SQRLEN)
+    for (int blk = 0; blk < numBlocks; blk++)
+      sum += partial[blk];
+  return sum;
+}
+
+double vecDotBlocked(int n, double v1[], double v2[], double partial[], ThreadPool *pool)
+{
+  return vecBlocked(VEC_DOT, n, v1, 0, v2, partial, pool);
+}
+
+void vecAssignBlocked(int n, double v1[], double v2[], ThreadPool *pool)
+{
+  vecBlocked(VEC_ASSIGN, n, v1, 0, v2, NULL, pool);
+}
+
+void vecAxpyBlocked(int n, double r[], double a, double v[], ThreadPool *pool)
+{
+  vecBlocked(VEC_AXPY, n, r, a, v, NULL, pool);
+}
+
+void vecXpayBlocked(int n, double d[], double beta, double z[], ThreadPool *pool)
+{
+  vecBlocked(VEC_XPAY, n, d, beta, z, NULL, pool);
+}
+
+double vecAxpySqrLenBlocked(int n, double r[], double a, double v[], double partial[], ThreadPool *pool)
+{
+  return vecBlocked(VEC_AXPY_SQRLEN, n, r, a, v, partial, pool);
+}
+
 double ConjGrad(int n, implicitMatrix *A, double x[], double b[], 
 		double epsilon,	// how low should we go?
-		int    *steps)
+		int    *steps,
+		SolverWorkspace *work,
+		preconditioner *M)
 {
   int		i, iMax;
-  double	alpha, beta, rSqrLen, rSqrLenOld, u;
-
-  double *r = (double *) malloc(sizeof(double) * n);
-  double *d = (double *) malloc(sizeof(double) * n);
-  double *t = (double *) malloc(sizeof(double) * n);
-  double *temp = (double *) malloc(sizeof(double) * n);
+  double	alpha, beta, rSqrLen, prevSqrLen, bestSqrLen, rz, rzOld, u;
+  double	*r, *d, *t, *temp, *z, *best, *partial;
+  ThreadPool	*pool;
 
-  vecAssign(n, x, b);
+  if (work) {
+    r = work->r;
+    d = work->d;
+    t = work->t;
+    temp = work->temp;
+    z = work->z;
+    best = work->best;
+    partial = work->partial.empty() ? NULL : &work->partial[0];
+    pool = work->pool;
+  } else {
+    r = (double *) malloc(sizeof(double) * n);
+    d = (double *) malloc(sizeof(double) * n);
+    t = (double *) malloc(sizeof(double) * n);
+    temp = (double *) malloc(sizeof(double) * n);
+    z = M ? (double *) malloc(sizeof(double) * n) : NULL;
+    best = (double *) malloc(sizeof(double) * n);
+    partial = (double *) malloc(sizeof(double) * (n / VEC_BLOCK + 1));
+    pool = NULL;
+  }
+  // without a preconditioner z = M^-1 r is just r
+  if (!M)
+    z = r;
 
   vecAssign(n, r, b);
   A->matVecMult(x, temp);
-  vecDiffEqual(n, r, temp);
+  rSqrLen = vecAxpySqrLenBlocked(n, r, -1.0, temp, partial, pool);
 
-  rSqrLen = vecSqrLen(n, r);
+  if (M)
+    M->apply(r, z);
+  rz = vecDotBlocked(n, r, z, partial, pool);
 
-  vecAssign(n, d, r);
+  vecAssign(n, d, z);
+  // no iterate has been kept in best yet
+  bestSqrLen = DBL_MAX;
+  prevSqrLen = rSqrLen;
 
   i = 0;
   if (*steps)
@@ -149,7 +606,7 @@ double ConjGrad(int n, implicitMatrix *A, double x[], double b[],
     while (i < iMax) {	
       i++;
       A->matVecMult(d, t);
-      u = vecDot(n, d, t);
+      u = vecDotBlocked(n, d, t, partial, pool);
       
       if (u == 0) {
 	printf("(SolveConjGrad) d'Ad = 0\n");
@@ -157,46 +614,66 @@ double ConjGrad(int n, implicitMatrix *A, double x[], double b[],
       }
       
       // How far should we go?
-      alpha = rSqrLen / u;
+      alpha = rz / u;
       
       // Take a step along direction d
-      vecAssign(n, temp, d);
-      vecTimesScalar(n, temp, alpha);
-      vecAddEqual(n, x, temp);
+      vecAxpyBlocked(n, x, alpha, d, pool);
       
       if (i & 0x3F) {
-	vecAssign(n, temp, t);
-	vecTimesScalar(n, temp, alpha);
-	vecDiffEqual(n, r, temp);
+	rSqrLen = vecAxpySqrLenBlocked(n, r, -alpha, t, partial, pool);
       } else {
 	// For stability, correct r every 64th iteration
 	vecAssign(n, r, b);
 	A->matVecMult(x, temp);
-	vecDiffEqual(n, r, temp);
+	rSqrLen = vecAxpySqrLenBlocked(n, r, -1.0, temp, partial, pool);
       }
       
-      rSqrLenOld = rSqrLen;
-      rSqrLen = vecSqrLen(n, r);
-      
       // Converged! Let's get out of here
       if (rSqrLen <= epsilon)
 	break;			    
+
+      // CG does not lower the residual every step, so in case the steps
+      // run out keep the last iterate, x - alpha d, when the residual
+      // rises from it. That is only on a rise, and the best iterate is
+      // either one of those or the last.
+      if (rSqrLen > prevSqrLen && prevSqrLen < bestSqrLen) {
+	vecAssignBlocked(n, best, x, pool);
+	vecAxpyBlocked(n, best, -alpha, d, pool);
+	bestSqrLen = prevSqrLen;
+      }
+      prevSqrLen = rSqrLen;
       
-      // Change direction: d = r + beta * d
-      beta = rSqrLen/rSqrLenOld;
-      vecTimesScalar(n, d, beta);
-      vecAddEqual(n, d, r);
+      rzOld = rz;
+      if (M) {
+	M->apply(r, z);
+	rz = vecDotBlocked(n, r, z, partial, pool);
+      } else {
+	rz = rSqrLen;
+      }
+
+      // Change direction: d = z + beta * d
+      beta = rz/rzOld;
+      vecXpayBlocked(n, d, beta, z, pool);
     }
   
+  if (rSqrLen > bestSqrLen) {
+    vecAssignBlocked(n, x, best, pool);
+    rSqrLen = bestSqrLen;
+  }
+
   // free memory
 
-  free(r);
-  free(d);
-  free(t);
-  free(temp);
+  if (!work) {
+    free(r);
+    free(d);
+    free(t);
+    free(temp);
+    if (M)
+      free(z);
+    free(best);
+    free(partial);
+  }
 		
   *steps = i;
   return(rSqrLen);
 }
-
-
@@ -8,10 +8,18 @@
 #include <vector>
 #include "CircularWireConstraint.h"
 #include "RodConstraint.h"
+#include "ParticleStore.h"
+#include "ThreadPool.h"
 
 // Karen's CGD
 
 #define MAX_STEPS 100
+// smallest pivot, relative to the diagonal entry, that the incomplete
+// Cholesky factorization accepts before falling back to the diagonal
+#define ICHOL_MIN_PIVOT 1.0e-10
+// the vector kernels of ConjGrad reduce over fixed blocks of this many
+// entries, so their results do not depend on the number of threads
+#define VEC_BLOCK 1024
 
 // Matrix class the solver will accept
 class implicitMatrix
@@ -22,33 +30,181 @@ class implicitMatrix
 
 };
 
-// Matrix class the solver will accept
+// The matrix J W J^T of the constraint solve. J is assembled once per
+// derivative evaluation as a sparse matrix with one row per constraint and
+// one Vec2 block per particle that the constraint touches, and W is the
+// diagonal matrix of inverse masses. Products with J W J^T are then two
+// sparse mat-vecs, so their cost is linear in the number of constraints.
 class implicitMatrixImpl : public implicitMatrix
 {
 public:
-    implicitMatrixImpl(std::vector<CircularWireConstraint*> i_wireConstVector,
-                           std::vector<RodConstraint*> i_rodConstVector);
+    implicitMatrixImpl();
     virtual ~implicitMatrixImpl();
+
+    // builds J and W from the constraints. Wire constraints are numbered
+    // first followed by the rod constraints, in the order of their vectors.
+    void assemble(const std::vector<CircularWireConstraint*> & wireConstVector,
+                  const std::vector<RodConstraint*> & rodConstVector,
+                  const ParticleStore & particles);
     virtual void matVecMult(double x[], double r[]);
+    // r = J W q for a per particle vector q
+    void jwMult(const std::vector<Vec2f> & q, double r[]);
+    // q += J^T x for a per particle vector q
+    void jtMultAdd(double x[], std::vector<Vec2f> & q);
+    // d = the diagonal of J W J^T
+    void diagonal(double d[]);
+    // builds the lower triangle of J W J^T, including the diagonal, in
+    // compressed rows with the columns of each row in increasing order
+    void lowerTriangle(std::vector<int> & o_rowStart, std::vector<int> & o_cols,
+                       std::vector<double> & o_vals);
+    int rows();
+    // splits matVecMult between the threads of pool, or runs it serially for NULL
+    void setPool(ThreadPool *pool);
 
 private:
-    // the constraits that define the elements of the matrix
-    std::vector<CircularWireConstraint*> wireConstVector;
-    std::vector<RodConstraint*> rodConstVector;
+    // J stored by rows: the blocks of row i are rowStart[i] to rowStart[i+1]
+    std::vector<int> rowStart;
+    std::vector<int> blockCol;
+    std::vector<Vec2> blocks;
+    // the particles touched by the constraints, which are the columns of J,
+    // and their inverse masses, which are the diagonal of W
+    std::vector<int> colParticle;
+    std::vector<double> colInvMass;
+    // maps a particle to its column of J, or -1 if it is unconstrained
+    std::vector<int> colOf;
+    // holds W J^T x between the two halves of matVecMult
+    std::vector<Vec2> scratch;
+    // J stored by columns as indices into blocks, used by lowerTriangle
+    // and by the threaded matVecMult
+    std::vector<int> colStart;
+    std::vector<int> colBlocks;
+    std::vector<int> blockRow;
+    bool transposed;
+    ThreadPool *pool;
+    // dense accumulator for one row of lowerTriangle
+    std::vector<double> rowAcc;
+    std::vector<int> rowMark;
+
+    void addBlock(int particle, const Vec2 & block, const ParticleStore & particles);
+    void transpose();
+    void matVecMultThreaded(double x[], double r[]);
+    // the two halves of matVecMult over columns and rows [begin, end)
+    void wjtMultColumns(double x[], double r[], int begin, int end);
+    void jMultRows(double x[], double r[], int begin, int end);
+
+    friend class matrixRangeTask;
+};
+
+// Preconditioner class the solver will accept. M approximates A and must be
+// symmetric positive definite; "setup" is called each time A is assembled.
+class preconditioner
+{
+ public:
+    virtual ~preconditioner() { }
+    virtual void setup(implicitMatrixImpl *A) = 0;
+    // z = M^-1 r
+    virtual void apply(double r[], double z[]) = 0;
 };
 
+// Uses the diagonal of J W J^T as M
+class jacobiPreconditioner : public preconditioner
+{
+ public:
+    jacobiPreconditioner();
+    virtual ~jacobiPreconditioner();
+    virtual void setup(implicitMatrixImpl *A);
+    virtual void apply(double r[], double z[]);
+
+ private:
+    std::vector<double> invDiag;
+};
+
+// Uses M = L L^T where L is the incomplete Cholesky factor of J W J^T with
+// no fill-in, i.e. L has the sparsity of the lower triangle of J W J^T
+class icholPreconditioner : public preconditioner
+{
+ public:
+    icholPreconditioner();
+    virtual ~icholPreconditioner();
+    virtual void setup(implicitMatrixImpl *A);
+    virtual void apply(double r[], double z[]);
 
+ private:
+    // L in compressed rows, the diagonal entry is last in each row
+    std::vector<int> rowStart;
+    std::vector<int> cols;
+    std::vector<double> vals;
+};
+
+enum PreconditionerType
+{
+    PRECOND_NONE,
+    PRECOND_JACOBI,
+    PRECOND_ICHOL
+};
+
+// returns a new preconditioner of the given type, or NULL for PRECOND_NONE
+preconditioner *createPreconditioner(PreconditionerType type);
+
+// The buffers of the constraint solve, kept alive across time steps so that
+// deriv_eval and ConjGrad do not touch the heap. They are only reallocated
+// when the number of constraints grows beyond what has been seen before.
+class SolverWorkspace
+{
+public:
+    SolverWorkspace(PreconditionerType precondType = PRECOND_NONE);
+    ~SolverWorkspace();
+
+    // makes room for n constraints
+    void resize(int n);
+    int size();
+    // splits the solve between the threads of pool, or runs it serially for NULL
+    void setPool(ThreadPool *pool);
+
+    implicitMatrixImpl JWJ_t;
+    // may be NULL, in which case the solve is not preconditioned
+    preconditioner *precond;
+    double *lambda;
+    double *b;
+    // scratch vectors for ConjGrad
+    double *r;
+    double *d;
+    double *t;
+    double *temp;
+    double *z;
+    // the iterate with the smallest residual so far
+    double *best;
+    ThreadPool *pool;
+    // the per block sums of the reductions in ConjGrad
+    std::vector<double> partial;
+
+private:
+    SolverWorkspace(const SolverWorkspace &);
+    SolverWorkspace & operator=(const SolverWorkspace &);
+
+    int n;
+    int capacity;
+};
 
 // Solve Ax = b for a symmetric, positive definite matrix A
 // A is represented implicitely by the function "matVecMult"
 // which performs a matrix vector multiple Av and places result in r
 // "n" is the length of the vectors x and b
+// "x", as passed, is the initial guess
 // "epsilon" is the error tolerance
 // "steps", as passed, is the maximum number of steps, or 0 (implying MAX_STEPS)
 // Upon completion, "steps" contains the number of iterations taken
+// The squared residual of x is returned. If the solve runs out of steps
+// before reaching epsilon, x is left at the iterate with the smallest one.
+// "work", if given, supplies the scratch vectors instead of allocating them
+// "M", if given, preconditions the solve
+// The vector operations are split between the threads of work->pool, if any,
+// and give the same results whatever the number of threads.
 double ConjGrad(int n, implicitMatrix *A, double x[], double b[], 
 		double epsilon,	// how low should we go?
-		int    *steps);
+		int    *steps,
+		SolverWorkspace *work = NULL,
+		preconditioner *M = NULL);
 
 // Some vector helper functions
 void vecAddEqual(int n, double r[], double v[]);
@@ -57,5 +213,17 @@ void vecAssign(int n, double v1[], double v2[]);
 void vecTimesScalar(int n, double v[], double s);
 double vecDot(int n, double v1[], double v2[]);
 double vecSqrLen(int n, double v[]);
+// r += a*v
+void vecAxpy(int n, double r[], double a, double v[]);
+// d = z + beta*d
+void vecXpay(int n, double d[], double beta, double z[]);
+// the blocked, threaded versions used by ConjGrad. partial needs room for
+// one sum per VEC_BLOCK entries and pool may be NULL.
+double vecDotBlocked(int n, double v1[], double v2[], double partial[], ThreadPool *pool);
+void vecAssignBlocked(int n, double v1[], double v2[], ThreadPool *pool);
+void vecAxpyBlocked(int n, double r[], double a, double v[], ThreadPool *pool);
+void vecXpayBlocked(int n, double d[], double beta, double z[], ThreadPool *pool);
+// r += a*v and returns the squared length of the new r, in one pass
+double vecAxpySqrLenBlocked(int n, double r[], double a, double v[], double partial[], ThreadPool *pool);
 
 #endif
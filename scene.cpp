@@ -0,0 +1,71 @@
+#include "scene.h"
+
+void build_cloth(System* sys, int w, int h)
+{
+        const double dist = 0.1;
+        const Vec2f center(-0.5, 0.5);
+        const Vec2f x_offset(dist, 0.0);
+        const Vec2f y_offset(0.0, -dist);
+        std::vector<Particle> pVector;
+
+        // add particles
+        for(int i = 0; i < h; ++i){
+            for(int k = 0; k < w; ++k){
+                pVector.push_back(sys->add_particle(center + k*x_offset + i*y_offset, 1.f));
+            }
+        }
+
+        // the two anchor particles
+        Particle left = sys->add_particle(center - 2*x_offset - y_offset, 3.f);
+        Particle right = sys->add_particle(center + (w+1)*x_offset - y_offset, 3.f);
+
+        // the anchor particles constraints and spring forces
+        sys->add_wireConst(new CircularWireConstraint(left, center - 3*x_offset - y_offset, dist));
+        sys->add_wireConst(new CircularWireConstraint(right, center + (w+2)*x_offset - y_offset, dist));
+        sys->add_springForce(left, pVector[0], 2*dist, 10.f, 1.f);
+        sys->add_springForce(right, pVector[w-1], 2*dist, 10.f, 1.f);
+
+        // add a rod constraint or spring force between alternating particles in the first row
+        for(int i = 0; i < w-1; ++i){
+            if(i%2 == 0)
+                sys->add_rodConst(new RodConstraint(pVector[i], pVector[i+1], dist));
+            else
+                sys->add_springForce(pVector[i], pVector[i+1], dist, 4.f, 1.f);
+        }
+
+        for(int i = 0; i < h-1; ++i){
+            for(int k = 0; k < w; ++k){
+                if(k != w-1){
+                    // weft springs
+                    sys->add_springForce(pVector[w*i + k + w], pVector[w*i + k + w + 1], dist, 4.f, 1.f);
+                    // shear springs
+                    sys->add_springForce(pVector[w*i + k + w], pVector[w*i + k + 1], sqrt(2)*dist, 4.f, 1.0f);
+                }
+                if(k != 0){
+                    // shear springs
+                    sys->add_springForce(pVector[w*i + k + w], pVector[w*i + k - 1], sqrt(2)*dist, 4.f, 1.f);
+                }
+                // warp springs
+                sys->add_springForce(pVector[w*i + k + w], pVector[w*i + k], dist, 4.f, 1.f);
+
+            }
+        }
+}
+
+void build_chain(System* sys, int n)
+{
+        const double dist = 0.1;
+        const Vec2f center(0.0, 0.5);
+        const Vec2f x_offset(dist, 0.0);
+
+        // the first particle sits on top of its wire
+        Particle prev = sys->add_particle(center + Vec2f(0.0, dist), 1.f);
+        sys->add_wireConst(new CircularWireConstraint(prev, center, dist));
+
+        // the chain starts out horizontal and swings down under gravity
+        for(int i = 1; i < n; ++i){
+            Particle p = sys->add_particle(center + Vec2f(0.0, dist) + i*x_offset, 1.f);
+            sys->add_rodConst(new RodConstraint(prev, p, dist));
+            prev = p;
+        }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "System.h"
+
+// Adds the cloth of the TinkerToy demo to the system: a w by h grid of
+// particles connected by warp, weft and shear springs, with the first row
+// joined alternately by rods and springs, hanging from two particles that
+// are constrained to circular wires. The grid's particles are numbered row
+// by row from 0 and the two anchors follow them.
+void build_cloth(System* sys, int w = 10, int h = 10);
+
+// Adds a chain of n particles joined by rod constraints whose first
+// particle is constrained to a circular wire.
+void build_chain(System* sys, int n);
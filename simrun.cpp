@@ -0,0 +1,311 @@
+// simrun.cpp : Runs a simulation without a window and writes the results to disk.
+//
+
+#include "System.h"
+#include "integrator.h"
+#include "scene.h"
+#include "SoftRenderer.h"
+#include "imageio.h"
+#include "Trajectory.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <algorithm>
+
+static void usage ( const char * name )
+{
+        printf("Usage: %s [options]\n", name);
+        printf("\t-scene cloth|chain  scene to build (default cloth)\n");
+        printf("\t-size N             cloth side or chain length (default 10 / 100)\n");
+        printf("\t-integrator K       1-euler, 2-RK2, 3-sympleticEuler, 4-RK4, 5-implicit Euler,\n");
+        printf("\t                    6-adaptive RK45, 7-velocity Verlet, 8-leapfrog (default 4)\n");
+        printf("\t-tol TOL            error tolerance of the adaptive integrator (default 1e-5)\n");
+        printf("\t-precond P          none, jacobi or ichol (default ichol)\n");
+        printf("\t-constraints C      lagrange, xpbd-gs or xpbd-jacobi (default lagrange)\n");
+        printf("\t-iterations N       XPBD iterations per step (default 10)\n");
+        printf("\t-compliance C       inverse stiffness of the rods and wires under XPBD,\n");
+        printf("\t                    0 for rigid (default 0)\n");
+        printf("\t-threads N          threads to evaluate the forces with (default 1)\n");
+        printf("\t-steps N            number of steps to integrate (default 1000)\n");
+        printf("\t-dt DT              time step (default 0.01)\n");
+        printf("\t-every K            write the state every K steps, 0 for the last only (default 0)\n");
+        printf("\t-out PREFIX         writes PREFIX_state.csv and PREFIX_metrics.csv (default simrun)\n");
+        printf("\t-trajectory FILE    records the run to FILE for playback in the viewer, one frame\n");
+        printf("\t                    every -every steps or every step when that is 0\n");
+        printf("\t-encoding E         float32 or float16 values in the trajectory (default float32)\n");
+        printf("\t-images K           draws the scene every K steps into PREFIX_00000.png and on,\n");
+        printf("\t                    0 for none (default 0)\n");
+        printf("\t-image-size N       width and height of the images in pixels (default 720)\n");
+        printf("\t-antialias 0|1      draws the lines of the images anti-aliased (default 1)\n");
+        printf("\t-stats FILE         writes the solve counters, and the timings of a SIM_PROFILE build,\n");
+        printf("\t                    as json if FILE ends in .json and as csv otherwise\n");
+        exit(-1);
+}
+
+static double wall_time ( void )
+{
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void write_state ( FILE * fp, System * sys, int step, double t )
+{
+        ParticleStore & p = sys->get_particles();
+        int size = p.size();
+
+        for(int i = 0; i < size; ++i){
+                fprintf(fp, "%d,%g,%d,%.9g,%.9g,%.9g,%.9g\n", step, t, i,
+                        p.position[i][0], p.position[i][1], p.velocity[i][0], p.velocity[i][1]);
+        }
+}
+
+// the largest violation of any constraint in the system
+static double max_constraint_error ( System * sys )
+{
+        const std::vector<RodConstraint*> & rods = sys->get_rodConst();
+        const std::vector<CircularWireConstraint*> & wires = sys->get_wireConst();
+        double err = 0;
+
+        // written so that a NaN, which std::max would drop, is kept and not
+        // replaced by a later error
+        for(int i = 0; i < rods.size(); ++i){
+                double c = fabs(rods[i]->get_C());
+                if(isnan(c) || c > err)
+                        err = c;
+        }
+        for(int i = 0; i < wires.size(); ++i){
+                double c = fabs(wires[i]->get_C());
+                if(isnan(c) || c > err)
+                        err = c;
+        }
+        return err;
+}
+
+int main ( int argc, char ** argv )
+{
+        const char * scene = "cloth";
+        const char * precond = "ichol";
+        const char * out = "simrun";
+        const char * statsFile = NULL;
+        const char * constraints = "lagrange";
+        int iterations = 10;
+        double compliance = 0;
+        const char * integratorName = "4";
+        int size = 0;
+        int steps = 1000;
+        int every = 0;
+        int threads = 1;
+        float dt = 0.01f;
+        double tol = 1.0e-5;
+        const char * trajectory = NULL;
+        const char * encoding = "float32";
+        int images = 0;
+        int imageSize = 720;
+        int antialias = 1;
+
+        for(int i = 1; i < argc; ++i){
+                if(i + 1 >= argc)
+                        usage(argv[0]);
+                if(!strcmp(argv[i], "-scene"))
+                        scene = argv[++i];
+                else if(!strcmp(argv[i], "-size"))
+                        size = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-integrator"))
+                        integratorName = argv[++i];
+                else if(!strcmp(argv[i], "-tol"))
+                        tol = atof(argv[++i]);
+                else if(!strcmp(argv[i], "-precond"))
+                        precond = argv[++i];
+                else if(!strcmp(argv[i], "-constraints"))
+                        constraints = argv[++i];
+                else if(!strcmp(argv[i], "-iterations"))
+                        iterations = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-compliance"))
+                        compliance = atof(argv[++i]);
+                else if(!strcmp(argv[i], "-threads"))
+                        threads = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-steps"))
+                        steps = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-dt"))
+                        dt = atof(argv[++i]);
+                else if(!strcmp(argv[i], "-every"))
+                        every = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-out"))
+                        out = argv[++i];
+                else if(!strcmp(argv[i], "-trajectory"))
+                        trajectory = argv[++i];
+                else if(!strcmp(argv[i], "-encoding"))
+                        encoding = argv[++i];
+                else if(!strcmp(argv[i], "-images"))
+                        images = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-image-size"))
+                        imageSize = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-antialias"))
+                        antialias = atoi(argv[++i]);
+                else if(!strcmp(argv[i], "-stats"))
+                        statsFile = argv[++i];
+                else
+                        usage(argv[0]);
+        }
+        if(strlen(integratorName) != 1 || integratorName[0] < '1' || integratorName[0] > '8'){
+                printf("unknown integrator %s\n", integratorName);
+                usage(argv[0]);
+        }
+        char integratorKey = integratorName[0];
+        if(strcmp(scene, "cloth") && strcmp(scene, "chain")){
+                printf("unknown scene %s\n", scene);
+                usage(argv[0]);
+        }
+        if(strcmp(precond, "none") && strcmp(precond, "jacobi") && strcmp(precond, "ichol")){
+                printf("unknown preconditioner %s\n", precond);
+                usage(argv[0]);
+        }
+        if(strcmp(constraints, "lagrange") && strcmp(constraints, "xpbd-gs") && strcmp(constraints, "xpbd-jacobi")){
+                printf("unknown constraint mode %s\n", constraints);
+                usage(argv[0]);
+        }
+        if(strcmp(encoding, "float32") && strcmp(encoding, "float16")){
+                printf("unknown encoding %s\n", encoding);
+                usage(argv[0]);
+        }
+
+        PreconditionerType precondType = PRECOND_ICHOL;
+        if(!strcmp(precond, "none"))
+                precondType = PRECOND_NONE;
+        else if(!strcmp(precond, "jacobi"))
+                precondType = PRECOND_JACOBI;
+
+        System * sys = new System(precondType);
+        if(!strcmp(scene, "chain")){
+                if(size <= 0)
+                        size = 100;
+                build_chain(sys, size);
+        } else{
+                if(size <= 0)
+                        size = 10;
+                build_cloth(sys, size, size);
+        }
+        sys->reset();
+        sys->set_threads(threads);
+        if(!strcmp(constraints, "xpbd-gs"))
+                sys->set_constraint_mode(CONSTRAINT_XPBD_GAUSS_SEIDEL, iterations, compliance);
+        else if(!strcmp(constraints, "xpbd-jacobi"))
+                sys->set_constraint_mode(CONSTRAINT_XPBD_JACOBI, iterations, compliance);
+
+        Integrator * integrator;
+        if(integratorKey == '6')
+                integrator = new AdaptiveRK45Integrator(tol, tol);
+        else
+                integrator = create_integrator(integratorKey);
+
+        char filename[1024];
+        snprintf(filename, sizeof(filename), "%s_state.csv", out);
+        FILE * state = fopen(filename, "w");
+        if(!state){
+                printf("could not open %s\n", filename);
+                exit(-1);
+        }
+        fprintf(state, "step,time,id,x,y,vx,vy\n");
+
+        // the images are drawn on the CPU like the viewer draws them, and
+        // encoded fast as the viewer dumps them
+        SoftRenderer * renderer = NULL;
+        PngOptions pngOptions;
+        pngOptions.compressionLevel = 1;
+        pngOptions.filters = PNG_FILTER_NONE;
+        pngOptions.rgb = true;
+        if(images > 0){
+                renderer = new SoftRenderer(imageSize, imageSize);
+                renderer->antialias = antialias != 0;
+        }
+
+        // the trajectory starts with the initial state
+        TrajectoryWriter * recorder = NULL;
+        int frameEvery = every > 0 ? every : 1;
+        if(trajectory){
+                recorder = new TrajectoryWriter(trajectory, *sys, frameEvery * (double)dt,
+                                                !strcmp(encoding, "float16") ? TRAJECTORY_FLOAT16 : TRAJECTORY_FLOAT32);
+                if(!recorder->is_open())
+                        exit(-1);
+                recorder->write_frame(*sys);
+        }
+
+        double imageTime = 0;
+        double start = wall_time();
+        for(int step = 1; step <= steps; ++step){
+                integrator->step(*sys, dt);
+                if((every > 0 && step % every == 0) || step == steps)
+                        write_state(state, sys, step, step * (double)dt);
+                if(recorder && step % frameEvery == 0)
+                        recorder->write_frame(*sys);
+                if(renderer && step % images == 0){
+                        double imageStart = wall_time();
+                        renderer->draw(*sys, sys->get_particles().position, 0.015f * imageSize);
+                        snprintf(filename, sizeof(filename), "%s_%05d.png", out, step / images - 1);
+                        if(!saveImageRGBA(filename, renderer->get_pixels(), imageSize, imageSize, pngOptions)){
+                                printf("could not write %s\n", filename);
+                                exit(-1);
+                        }
+                        imageTime += wall_time() - imageStart;
+                }
+        }
+        // the metrics time the simulation alone
+        double elapsed = wall_time() - start - imageTime;
+        delete renderer;
+        delete recorder;
+        fclose(state);
+
+        snprintf(filename, sizeof(filename), "%s_metrics.csv", out);
+        FILE * metrics = fopen(filename, "w");
+        if(!metrics){
+                printf("could not open %s\n", filename);
+                exit(-1);
+        }
+        double constraintError = max_constraint_error(sys);
+        long failedSolves = sys->get_stats().failedSolves;
+        fprintf(metrics, "scene,particles,springs,rods,wires,integrator,precond,threads,dt,steps,seconds,seconds_per_step,max_constraint_error,failed_solves\n");
+        fprintf(metrics, "%s,%d,%d,%d,%d,%c,%s,%d,%g,%d,%g,%g,%g,%ld\n", scene, sys->size(),
+                sys->get_springs().size(), (int)sys->get_rodConst().size(),
+                (int)sys->get_wireConst().size(), integratorKey, precond, threads, dt, steps,
+                elapsed, steps > 0 ? elapsed / steps : 0.0, constraintError, failedSolves);
+        fclose(metrics);
+
+        AdaptiveRK45Integrator * adaptive = dynamic_cast<AdaptiveRK45Integrator *>(integrator);
+        if(adaptive)
+                printf("%d substeps accepted, %d rejected, next substep %g\n",
+                       adaptive->accepted_steps(), adaptive->rejected_steps(), adaptive->step_size());
+
+        if(statsFile){
+                FILE * fp = fopen(statsFile, "w");
+                if(!fp){
+                        printf("could not open %s\n", statsFile);
+                        exit(-1);
+                }
+                int len = strlen(statsFile);
+                if(len >= 5 && !strcmp(statsFile + len - 5, ".json"))
+                        sys->get_stats().print_json(fp);
+                else
+                        sys->get_stats().print_csv(fp);
+                fclose(fp);
+        }
+
+        printf("%d steps of %d particles in %g s\n", steps, sys->size(), elapsed);
+        if(images > 0)
+                printf("%d images in %g s\n", steps / images, imageTime);
+
+        delete integrator;
+        delete sys;
+
+        // the metrics are written either way, but a run whose solves failed
+        // or whose constraints blew up does not count as a success
+        if(failedSolves > 0 || !isfinite(constraintError)){
+                printf("the run failed: %ld solves did not converge, max constraint error %g\n",
+                       failedSolves, constraintError);
+                exit(-1);
+        }
+        exit ( 0 );
+}